@@ -0,0 +1,145 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include "workerpool.h"
+#include "headless.h"
+
+using namespace Simulation;
+
+//
+// Regression sweep: plays N seeds of every map given, each seed a trial of
+// the map's runs with a fresh controller, spread over a WorkerPool. Trials
+// share nothing but the maps, so the sweep scales with the cores; each one
+// plans on its own thread, without local planner helpers.
+//
+
+struct Sweep {
+	std::vector<WorldMap> maps;
+	int seeds;
+	unsigned first_seed;
+	int runs; // per trial, 0 for all of the map's
+	long budget;
+	PathFind::Planner planner;
+	std::vector<std::vector<RunResult> > results; // per trial, map-major
+	std::vector<long> ticks; // per trial
+	std::vector<long long> tick_usec; // per trial
+};
+
+static void playTrials(void *context, int begin, int end) {
+	Sweep *sweep = static_cast<Sweep *>(context);
+	for (int i = begin; i < end; ++i) {
+		const WorldMap& map = sweep->maps[i / sweep->seeds];
+		HeadlessTrial trial(map);
+		trial.setPlanningBudget(sweep->budget);
+		trial.setPlanner(sweep->planner);
+		trial.setLocalThreads(0);
+		int runs = sweep->runs > 0 ? sweep->runs : static_cast<int>(map.runs.size());
+		trial.play(runs, sweep->first_seed + i % sweep->seeds, sweep->results[i]);
+		sweep->ticks[i] = trial.ticks();
+		sweep->tick_usec[i] = trial.tickUsec();
+	}
+}
+
+// Nearest-rank percentile of sorted values.
+static int percentile(const std::vector<int>& sorted, int p) {
+	if (sorted.empty())
+		return 0;
+	std::size_t rank = (sorted.size() * p + 99) / 100;
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void usage() {
+	fprintf(stderr, "usage: icfpRover-bench [-n seeds] [-j threads] [-r runs] [-s first_seed] [-b budget_usec] [-p planner] <map.wrld>...\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	Sweep sweep;
+	sweep.seeds = 10;
+	sweep.first_seed = 0;
+	sweep.runs = 0;
+	sweep.budget = HEADLESS_PLANNING_BUDGET;
+	sweep.planner = PathFind::INCREMENTAL;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads = cores > 0 ? static_cast<int>(cores) : 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:j:r:s:b:p:")) != -1) {
+		switch (opt) {
+			case 'n': sweep.seeds = atoi(optarg); break;
+			case 'j': threads = atoi(optarg); break;
+			case 'r': sweep.runs = atoi(optarg); break;
+			case 's': sweep.first_seed = static_cast<unsigned>(strtoul(optarg, NULL, 10)); break;
+			case 'b': sweep.budget = atol(optarg); break;
+			case 'p': if (!PathFind::plannerNamed(optarg, sweep.planner)) usage(); break;
+			default: usage();
+		}
+	}
+	if (optind == argc || sweep.seeds <= 0 || threads <= 0)
+		usage();
+
+	std::vector<std::string> names(argv + optind, argv + argc);
+	sweep.maps.resize(names.size());
+	for (std::size_t m = 0; m < names.size(); ++m) {
+		std::string error;
+		if (!sweep.maps[m].load(names[m], error)) {
+			std::cerr << error << std::endl;
+			return 1;
+		}
+	}
+	int trials = static_cast<int>(sweep.maps.size()) * sweep.seeds;
+	sweep.results.resize(trials);
+	sweep.ticks.resize(trials);
+	sweep.tick_usec.resize(trials);
+	struct timespec started, finished;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	{
+		WorkerPool pool(threads - 1);
+		pool.run(playTrials, &sweep, trials, 1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+	double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) * 1e-9;
+
+	printf("%-24s %5s %7s %6s %6s %7s %7s %8s %7s %7s %7s\n",
+		"map", "runs", "success", "crater", "killed", "timeout", "crashes", "mean", "p50", "p90", "max");
+	int total_runs = 0, total_success = 0;
+	long long total_simulated_ms = 0, total_ticks = 0, total_tick_usec = 0;
+	for (std::size_t m = 0; m < sweep.maps.size(); ++m) {
+		int outcomes[5] = { 0, 0, 0, 0, 0 };
+		int crashes = 0;
+		long long score = 0;
+		std::vector<int> scores;
+		for (int s = 0; s < sweep.seeds; ++s) {
+			int i = static_cast<int>(m) * sweep.seeds + s;
+			const std::vector<RunResult>& results = sweep.results[i];
+			for (std::size_t r = 0; r < results.size(); ++r) {
+				++outcomes[results[r].outcome];
+				crashes += results[r].crashes;
+				score += results[r].score;
+				scores.push_back(results[r].score);
+				total_simulated_ms += results[r].time;
+			}
+			total_ticks += sweep.ticks[i];
+			total_tick_usec += sweep.tick_usec[i];
+		}
+		std::sort(scores.begin(), scores.end());
+		int runs = static_cast<int>(scores.size());
+		std::string name = names[m].substr(names[m].find_last_of('/') + 1);
+		printf("%-24s %5d %6.1f%% %6d %6d %7d %7d %8lld %7d %7d %7d\n",
+			name.c_str(), runs, runs > 0 ? 100.0 * outcomes[Simulator::SUCCESS] / runs : 0.0,
+			outcomes[Simulator::CRATER], outcomes[Simulator::KILLED], outcomes[Simulator::TIMEOUT], crashes,
+			runs > 0 ? score / runs : 0, percentile(scores, 50), percentile(scores, 90),
+			scores.empty() ? 0 : scores.back());
+		total_runs += runs;
+		total_success += outcomes[Simulator::SUCCESS];
+	}
+	printf("%d trials, %d runs, %.1f%% success; %.1f s simulated in %.1f s on %d threads (%.0fx), %lld usec per tick\n",
+		trials, total_runs, total_runs > 0 ? 100.0 * total_success / total_runs : 0.0,
+		total_simulated_ms * 0.001, seconds, threads, seconds > 0.0 ? total_simulated_ms * 0.001 / seconds : 0.0,
+		total_ticks > 0 ? total_tick_usec / total_ticks : 0);
+	return 0;
+}
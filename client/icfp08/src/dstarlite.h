@@ -0,0 +1,307 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <ctime>
+#include <limits>
+#include "vector2.h"
+#include "occupancy.h"
+#include "indexedheap.h"
+#include "gridplanner.h"
+
+namespace Movement {
+
+	const float INFINITE_COST = std::numeric_limits<float>::max();
+
+	//
+	// D* Lite over an OccupancyGrid, 8-connected.
+	//
+	// The search runs backwards from the goal, so the rover can move without
+	// invalidating it. When obstacles enter sensor range, only the cells around
+	// the ones that turned blocked are updated, and the next search repairs the
+	// part of the tree they affect instead of starting over.
+	//
+	// Searches are bounded by a time budget like GridPlanner's. An unfinished
+	// search keeps its queue and simply resumes on the next tick.
+	//
+	class IncrementalPlanner {
+		public:
+			struct Stats {
+				int expanded; // nodes expanded by the last tick
+				int updated; // nodes whose rhs was recomputed after obstacle changes in the last tick
+				long expanded_total; // since the last full reset
+				int resets; // full searches from scratch
+			};
+
+			IncrementalPlanner() : m_budget_usec(20000), m_width(0), m_height(0), m_goal(-1), m_start(-1), m_last(-1), m_km(0.0f), m_generation(0) {
+				m_stats.expanded = m_stats.updated = m_stats.resets = 0;
+				m_stats.expanded_total = 0;
+			}
+
+			void setBudget(long usec) {
+				m_budget_usec = usec;
+			}
+			const Stats& stats() const {
+				return m_stats;
+			}
+			const std::vector<Vector2>& path() const {
+				return m_path;
+			}
+			// Forgets the search, the next plan() starts from scratch.
+			void invalidate() {
+				m_width = m_height = 0;
+			}
+
+			GridPlanner::Result plan(const OccupancyGrid& grid, const Vector2& from, const Vector2& to) {
+				m_path.clear();
+				m_stats.expanded = m_stats.updated = 0;
+				if (grid.empty())
+					return GridPlanner::NO_PATH;
+
+				int goal = grid.cellY(to.y) * grid.width() + grid.cellX(to.x);
+				int start = freeCell(grid, grid.cellY(from.y) * grid.width() + grid.cellX(from.x));
+				if (grid.width() != m_width || grid.height() != m_height || goal != m_goal || grid.generation() != m_generation) {
+					reset(grid, goal, start);
+				} else {
+					m_km += heuristic(m_last, start);
+					m_last = start;
+					applyChanges(grid);
+				}
+				m_start = start;
+
+				bool done = computeShortestPath();
+				if (m_rhs[m_start] == INFINITE_COST)
+					return done ? GridPlanner::NO_PATH : GridPlanner::PARTIAL_PATH;
+				buildPath(grid, from, to);
+				return done ? GridPlanner::FOUND_PATH : GridPlanner::PARTIAL_PATH;
+			}
+
+		private:
+			struct Key {
+				float k1;
+				float k2;
+				Key() : k1(0.0f), k2(0.0f) {}
+				Key(float a, float b) : k1(a), k2(b) {}
+				bool operator<(const Key& other) const {
+					return k1 < other.k1 || (k1 == other.k1 && k2 < other.k2);
+				}
+			};
+
+			void reset(const OccupancyGrid& grid, int goal, int start) {
+				std::size_t nodes = grid.width() * grid.height();
+				m_width = grid.width();
+				m_height = grid.height();
+				m_generation = grid.generation();
+				m_g.assign(nodes, INFINITE_COST);
+				m_rhs.assign(nodes, INFINITE_COST);
+				m_open.resize(nodes);
+				m_blocked.assign(nodes, 0);
+				for (int j = 0; j < m_height; ++j)
+					for (int i = 0; i < m_width; ++i)
+						m_blocked[j * m_width + i] = grid.blocked(i, j);
+				// Home is reached by touching it, its cell is never an obstacle.
+				m_blocked[goal] = 0;
+				m_goal = goal;
+				m_last = m_start = start;
+				m_km = 0.0f;
+				m_rhs[m_goal] = 0.0f;
+				m_open.push(m_goal, Key(heuristic(m_start, m_goal), 0.0f));
+				m_stats.expanded_total = 0;
+				++m_stats.resets;
+			}
+
+			// Rover centers inside an inflated obstacle search from a free neighbor.
+			int freeCell(const OccupancyGrid& grid, int cell) const {
+				if (!grid.blocked(cell))
+					return cell;
+				int ci = cell % grid.width(), cj = cell / grid.width();
+				for (int k = 0; k < 8; ++k) {
+					int i = ci + NEIGHBOR_DX[k], j = cj + NEIGHBOR_DY[k];
+					if (grid.contains(i, j) && !grid.blocked(i, j))
+						return j * grid.width() + i;
+				}
+				return cell;
+			}
+
+			//
+			// Cost of moving between neighbor cells u and v (k is the neighbor
+			// index of v around u): infinite through blocked cells or corners.
+			//
+			float cost(int u, int v, int k) const {
+				if (m_blocked[u] || m_blocked[v])
+					return INFINITE_COST;
+				if (NEIGHBOR_DX[k] != 0 && NEIGHBOR_DY[k] != 0) {
+					int ui = u % m_width, uj = u / m_width;
+					if (m_blocked[uj * m_width + ui + NEIGHBOR_DX[k]] || m_blocked[(uj + NEIGHBOR_DY[k]) * m_width + ui])
+						return INFINITE_COST;
+				}
+				return NEIGHBOR_COST[k];
+			}
+			float heuristic(int a, int b) const {
+				float dx = std::fabs(static_cast<float>(a % m_width - b % m_width));
+				float dy = std::fabs(static_cast<float>(a / m_width - b / m_width));
+				// Octile distance, consistent with the 8-connected costs.
+				return std::max(dx, dy) + (NEIGHBOR_COST[4] - 1.0f) * std::min(dx, dy);
+			}
+			Key calculateKey(int s) const {
+				float best = std::min(m_g[s], m_rhs[s]);
+				return Key(best + heuristic(m_start, s) + m_km, best);
+			}
+			bool neighbor(int u, int k, int& v) const {
+				int i = u % m_width + NEIGHBOR_DX[k], j = u / m_width + NEIGHBOR_DY[k];
+				if (i < 0 || j < 0 || i >= m_width || j >= m_height)
+					return false;
+				v = j * m_width + i;
+				return true;
+			}
+			float bestRhs(int u) const {
+				float best = INFINITE_COST;
+				int v;
+				for (int k = 0; k < 8; ++k) {
+					if (!neighbor(u, k, v))
+						continue;
+					float c = cost(u, v, k);
+					if (c != INFINITE_COST && m_g[v] != INFINITE_COST && c + m_g[v] < best)
+						best = c + m_g[v];
+				}
+				return best;
+			}
+			void updateVertex(int u) {
+				if (m_g[u] != m_rhs[u])
+					m_open.push(u, calculateKey(u));
+				else
+					m_open.remove(u);
+			}
+
+			//
+			// Copies the newly blocked cells and recomputes the nodes whose
+			// edges they affect: the cells themselves and their neighbors.
+			//
+			void applyChanges(const OccupancyGrid& grid) {
+				const std::vector<int>& changes = grid.changes();
+				for (std::size_t c = 0; c < changes.size(); ++c)
+					if (changes[c] != m_goal)
+						m_blocked[changes[c]] = 1;
+				for (std::size_t c = 0; c < changes.size(); ++c) {
+					int cell = changes[c];
+					refresh(cell);
+					int u;
+					for (int k = 0; k < 8; ++k)
+						if (neighbor(cell, k, u))
+							refresh(u);
+				}
+			}
+			void refresh(int u) {
+				if (u == m_goal)
+					return;
+				m_rhs[u] = bestRhs(u);
+				updateVertex(u);
+				++m_stats.updated;
+			}
+
+			bool computeShortestPath() {
+				struct timespec deadline;
+				clock_gettime(CLOCK_MONOTONIC, &deadline);
+				deadline.tv_sec += m_budget_usec / 1000000;
+				deadline.tv_nsec += (m_budget_usec % 1000000) * 1000;
+				if (deadline.tv_nsec >= 1000000000) {
+					deadline.tv_nsec -= 1000000000;
+					++deadline.tv_sec;
+				}
+				while (!m_open.empty() && (m_open.topKey() < calculateKey(m_start) || m_rhs[m_start] > m_g[m_start])) {
+					if ((++m_stats.expanded & 63) == 0) {
+						struct timespec now;
+						clock_gettime(CLOCK_MONOTONIC, &now);
+						if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
+							break;
+					}
+					++m_stats.expanded_total;
+					int u = m_open.top();
+					Key k_old = m_open.topKey();
+					Key k_new = calculateKey(u);
+					int s;
+					if (k_old < k_new) {
+						m_open.push(u, k_new);
+					} else if (m_g[u] > m_rhs[u]) {
+						m_g[u] = m_rhs[u];
+						m_open.remove(u);
+						for (int k = 0; k < 8; ++k) {
+							if (!neighbor(u, k, s) || s == m_goal)
+								continue;
+							float c = cost(u, s, k); // costs are symmetric
+							if (c != INFINITE_COST && c + m_g[u] < m_rhs[s]) {
+								m_rhs[s] = c + m_g[u];
+								updateVertex(s);
+							}
+						}
+					} else {
+						m_g[u] = INFINITE_COST;
+						if (u != m_goal)
+							m_rhs[u] = bestRhs(u);
+						updateVertex(u);
+						for (int k = 0; k < 8; ++k) {
+							if (!neighbor(u, k, s) || s == m_goal)
+								continue;
+							m_rhs[s] = bestRhs(s);
+							updateVertex(s);
+						}
+					}
+				}
+				return m_open.empty() || !(m_open.topKey() < calculateKey(m_start) || m_rhs[m_start] > m_g[m_start]);
+			}
+
+			//
+			// Follows the cheapest neighbors from the start down to the goal,
+			// then pulls the string tight wherever the grid has line of sight.
+			//
+			void buildPath(const OccupancyGrid& grid, const Vector2& from, const Vector2& to) {
+				m_cells.clear();
+				int u = m_start;
+				m_cells.push_back(u);
+				for (int steps = 0; u != m_goal && steps < m_width * m_height; ++steps) {
+					int best = -1, v;
+					float best_cost = INFINITE_COST;
+					for (int k = 0; k < 8; ++k) {
+						if (!neighbor(u, k, v) || m_g[v] == INFINITE_COST)
+							continue;
+						float c = cost(u, v, k);
+						if (c != INFINITE_COST && c + m_g[v] < best_cost) {
+							best_cost = c + m_g[v];
+							best = v;
+						}
+					}
+					if (best == -1)
+						break;
+					u = best;
+					m_cells.push_back(u);
+				}
+				m_path.push_back(from);
+				std::size_t anchor = 0;
+				for (std::size_t i = 1; i < m_cells.size(); ++i) {
+					if (i + 1 < m_cells.size() && grid.lineOfSight(m_cells[anchor], m_cells[i + 1]))
+						continue;
+					m_path.push_back(grid.center(m_cells[i] % m_width, m_cells[i] / m_width));
+					anchor = i;
+				}
+				if (u == m_goal)
+					m_path.back() = to;
+			}
+
+			long m_budget_usec;
+			int m_width;
+			int m_height;
+			int m_goal;
+			int m_start;
+			int m_last;
+			float m_km;
+			unsigned m_generation;
+			std::vector<float> m_g;
+			std::vector<float> m_rhs;
+			std::vector<unsigned char> m_blocked; // grid as of the last applied change
+			IndexedHeap<Key> m_open;
+			std::vector<int> m_cells;
+			std::vector<Vector2> m_path;
+			Stats m_stats;
+	};
+
+}
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cmath>
+#include <algorithm>
+
+#define DECLARE_ENUM_OPERATORS(_TYPE) \
+	inline _TYPE& \
+	operator++(_TYPE& v1) \
+	{ v1 = _TYPE(static_cast<int>(v1) + 1); return v1; } \
+	\
+	inline _TYPE& \
+	operator--(_TYPE& v1) \
+	{ v1 = _TYPE(static_cast<int>(v1) - 1); return v1; }
+
+namespace Movement {
+
+	enum MoveState {
+		BREAKING		= -1,
+		ROLLING			= 0,
+		ACCELERATING	= 1
+	};
+	DECLARE_ENUM_OPERATORS(MoveState)
+
+	enum TurnState {
+		HARD_LEFT	= -2,
+		LEFT		= -1,
+		STRAIGHT	= 0,
+		RIGHT		= 1,
+		HARD_RIGHT	= 2
+	};
+	DECLARE_ENUM_OPERATORS(TurnState)
+
+	//
+	// Vehicle parameters. The initialization message only tells the maximum
+	// speed and turn rates; the rest start at the values of the sample maps'
+	// vehicleParams and are refined from the telemetry by VehicleModel::observe().
+	//
+	struct VehicleParams {
+		float max_speed; // meters per second
+		float accel; // meters per second squared
+		float brake; // meters per second squared
+		float turn; // degrees per second
+		float hard_turn; // degrees per second
+		float rot_accel; // degrees per second squared
+
+		VehicleParams() : max_speed(20.0f), accel(2.0f), brake(3.0f), turn(20.0f), hard_turn(60.0f), rot_accel(120.0f) {
+			// nop
+		}
+		// Drag coefficient, such that accelerating stops paying off at max_speed.
+		float drag() const {
+			return accel / (max_speed * max_speed);
+		}
+	};
+
+	struct VehicleState {
+		float x; // meters
+		float y; // meters
+		float dir; // counterclockwise angle from the x-axis in degrees
+		float speed; // meters per second
+		float turn_rate; // counterclockwise degrees per second
+		MoveState move;
+		TurnState turn;
+	};
+
+	// Control state the vehicle is driven towards, one notch per command.
+	struct VehicleCommand {
+		MoveState move;
+		TurnState turn;
+	};
+
+	//
+	// Kinematic model of the rover: speed follows the accelerating, rolling or
+	// braking state against a drag quadratic in the speed, and the turn rate
+	// approaches the rate of the turn state at the rotational acceleration.
+	//
+	// Stepping is a handful of flops and one sin/cos pair, so thousands of
+	// short rollouts fit in a telemetry period.
+	//
+	class VehicleModel {
+		public:
+			VehicleModel() : m_last_timestamp(-1) {
+				// nop
+			}
+
+			const VehicleParams& params() const {
+				return m_params;
+			}
+			void setParams(const VehicleParams& params) {
+				m_params = params;
+			}
+			// Takes the limits announced by the initialization message.
+			void initialize(float max_speed, float max_turn, float max_hard_turn) {
+				m_params.max_speed = max_speed;
+				m_params.turn = max_turn;
+				m_params.hard_turn = max_hard_turn;
+				m_last_timestamp = -1;
+			}
+
+			static MoveState moveState(char ctl) {
+				switch (ctl) {
+					case 'a': return ACCELERATING;
+					case 'b': return BREAKING;
+					default: return ROLLING;
+				}
+			}
+			static TurnState turnState(char ctl) {
+				switch (ctl) {
+					case 'L': return HARD_LEFT;
+					case 'l': return LEFT;
+					case 'r': return RIGHT;
+					case 'R': return HARD_RIGHT;
+					default: return STRAIGHT;
+				}
+			}
+
+			// Turn rate the vehicle settles at in a turn state (counterclockwise degrees per second).
+			float turnRate(TurnState turn) const {
+				switch (turn) {
+					case HARD_LEFT: return m_params.hard_turn;
+					case LEFT: return m_params.turn;
+					case RIGHT: return -m_params.turn;
+					case HARD_RIGHT: return -m_params.hard_turn;
+					default: return 0.0f;
+				}
+			}
+
+			//
+			// Refines the parameters from a telemetry report, comparing it with
+			// the previous one, and fills in its turn rate.
+			//
+			void observe(int timestamp, VehicleState& reported) {
+				if (m_last_timestamp >= 0 && timestamp > m_last_timestamp) {
+					float dt = (timestamp - m_last_timestamp) * 0.001f;
+					float dv = (reported.speed - m_last.speed) / dt;
+					float ratio = m_last.speed / m_params.max_speed;
+					float drag = ratio * ratio;
+					// dv = accel * (1 - drag) while accelerating, away from the top speed.
+					if (m_last.move == ACCELERATING && drag < 0.8f && dv > 0.0f)
+						m_params.accel += 0.2f * (dv / (1.0f - drag) - m_params.accel);
+					// dv = -brake - accel * drag while braking, unless already stopped.
+					else if (m_last.move == BREAKING && reported.speed > 0.1f)
+						m_params.brake += 0.2f * (-dv - m_params.accel * drag - m_params.brake);
+					reported.turn_rate = std::fmod(reported.dir - m_last.dir + 540.0f, 360.0f) - 180.0f;
+					reported.turn_rate /= dt;
+				} else {
+					reported.turn_rate = turnRate(reported.turn);
+				}
+				m_last = reported;
+				m_last_timestamp = timestamp;
+			}
+
+			// Advances the state by dt seconds under its current control state.
+			void step(VehicleState& s, float dt) const {
+				float target = turnRate(s.turn);
+				float change = m_params.rot_accel * dt;
+				if (s.turn_rate < target)
+					s.turn_rate = std::min(target, s.turn_rate + change);
+				else
+					s.turn_rate = std::max(target, s.turn_rate - change);
+
+				float accel = -m_params.drag() * s.speed * s.speed;
+				if (s.move == ACCELERATING)
+					accel += m_params.accel;
+				else if (s.move == BREAKING)
+					accel -= m_params.brake;
+				s.speed = std::max(0.0f, s.speed + accel * dt);
+
+				s.dir += s.turn_rate * dt;
+				if (s.dir >= 180.0f)
+					s.dir -= 360.0f;
+				else if (s.dir < -180.0f)
+					s.dir += 360.0f;
+				float heading = s.dir * static_cast<float>(M_PI) / 180.0f;
+				s.x += s.speed * std::cos(heading) * dt;
+				s.y += s.speed * std::sin(heading) * dt;
+			}
+
+			// Advances the state by `seconds`, in steps of at most dt.
+			void advance(VehicleState& s, float seconds, float dt) const {
+				while (seconds > 0.0f) {
+					float h = std::min(seconds, dt);
+					step(s, h);
+					seconds -= h;
+				}
+			}
+
+			//
+			// Simulates a command sequence from s: each of the `steps` periods of
+			// dt seconds, the control state moves one notch towards the command
+			// (as a single command character would) and then is integrated in
+			// `substeps` steps. The position at the start of every period is
+			// written to xs and ys, if given, and the final state is returned.
+			//
+			VehicleState rollout(VehicleState s, const VehicleCommand *commands, int steps, float dt, int substeps, float *xs, float *ys) const {
+				float h = dt / substeps;
+				for (int k = 0; k < steps; ++k) {
+					if (xs != NULL) {
+						xs[k] = s.x;
+						ys[k] = s.y;
+					}
+					if (s.move < commands[k].move)
+						++s.move;
+					else if (s.move > commands[k].move)
+						--s.move;
+					if (s.turn < commands[k].turn)
+						++s.turn;
+					else if (s.turn > commands[k].turn)
+						--s.turn;
+					for (int i = 0; i < substeps; ++i)
+						step(s, h);
+				}
+				return s;
+			}
+
+		private:
+			VehicleParams m_params;
+			VehicleState m_last;
+			int m_last_timestamp;
+	};
+
+}
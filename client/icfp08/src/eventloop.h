@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdio>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+namespace Communication {
+
+	//
+	// Blocks on epoll until a watched descriptor is readable, or writable while
+	// that is wanted, or another thread calls wake(), then runs the matching
+	// handlers on the calling thread.
+	//
+	class EventLoop {
+		public:
+			typedef void (*Handler)(void *context);
+
+			EventLoop() : m_watch_count(0), m_wake_handler(NULL), m_wake_context(NULL), m_running(false) {
+				m_epoll = epoll_create1(EPOLL_CLOEXEC);
+				if (m_epoll == -1)
+					perror("epoll_create1");
+				m_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+				if (m_wake_fd == -1)
+					perror("eventfd");
+				else
+					add(m_wake_fd, NULL, NULL);
+			}
+			~EventLoop() {
+				if (m_wake_fd != -1)
+					close(m_wake_fd);
+				if (m_epoll != -1)
+					close(m_epoll);
+			}
+
+			// Runs handler(context) whenever fd is readable, and writable(context)
+			// whenever it is writable while wantWritable() says so.
+			bool watch(int fd, Handler handler, void *context, Handler writable = NULL) {
+				return add(fd, handler, context, writable);
+			}
+			// Only worth it while there is something left to write.
+			bool wantWritable(int fd, bool wanted) {
+				for (int i = 1; i < m_watch_count; ++i) {
+					Watch *watch = &m_watches[i];
+					if (watch->fd != fd)
+						continue;
+					if (watch->want_writable == wanted)
+						return true;
+					struct epoll_event event;
+					event.events = wanted ? EPOLLIN | EPOLLOUT : EPOLLIN;
+					event.data.ptr = watch;
+					if (epoll_ctl(m_epoll, EPOLL_CTL_MOD, fd, &event) == -1) {
+						perror("epoll_ctl");
+						return false;
+					}
+					watch->want_writable = wanted;
+					return true;
+				}
+				return false;
+			}
+			// Runs handler(context) after every wake().
+			void onWake(Handler handler, void *context) {
+				m_wake_handler = handler;
+				m_wake_context = context;
+			}
+			// Safe from any thread; wakes coalesce until the loop gets to them.
+			void wake() {
+				uint64_t one = 1;
+				if (::write(m_wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+					perror("write");
+			}
+
+			// Dispatches events until stop() is called from a handler.
+			void run() {
+				m_running = true;
+				struct epoll_event events[MAX_EVENTS];
+				while (m_running) {
+					int count = epoll_wait(m_epoll, events, MAX_EVENTS, -1);
+					if (count == -1) {
+						if (errno == EINTR)
+							continue;
+						perror("epoll_wait");
+						break;
+					}
+					for (int i = 0; i < count && m_running; ++i) {
+						Watch *watch = static_cast<Watch *>(events[i].data.ptr);
+						if (watch == &m_watches[0]) {
+							uint64_t pending;
+							while (::read(m_wake_fd, &pending, sizeof(pending)) > 0)
+								continue;
+							if (m_wake_handler != NULL)
+								m_wake_handler(m_wake_context);
+						} else {
+							if ((events[i].events & EPOLLOUT) && watch->writable != NULL)
+								watch->writable(watch->context);
+							if (events[i].events & ~EPOLLOUT)
+								watch->handler(watch->context);
+						}
+					}
+				}
+			}
+			void stop() {
+				m_running = false;
+			}
+
+		private:
+			static const int MAX_EVENTS = 8;
+			static const int MAX_WATCHES = 8;
+
+			struct Watch {
+				int fd;
+				Handler handler;
+				void *context;
+				Handler writable; // NULL if never wanted
+				bool want_writable;
+			};
+
+			bool add(int fd, Handler handler, void *context, Handler writable = NULL) {
+				if (m_watch_count == MAX_WATCHES)
+					return false;
+				Watch *watch = &m_watches[m_watch_count];
+				watch->fd = fd;
+				watch->handler = handler;
+				watch->context = context;
+				watch->writable = writable;
+				watch->want_writable = false;
+				struct epoll_event event;
+				event.events = EPOLLIN;
+				event.data.ptr = watch;
+				if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) == -1) {
+					perror("epoll_ctl");
+					return false;
+				}
+				++m_watch_count;
+				return true;
+			}
+
+			int m_epoll;
+			int m_wake_fd;
+			Watch m_watches[MAX_WATCHES]; // the wake descriptor first
+			int m_watch_count;
+			Handler m_wake_handler;
+			void *m_wake_context;
+			volatile bool m_running;
+	};
+
+}
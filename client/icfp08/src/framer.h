@@ -0,0 +1,133 @@
+#pragma once
+
+#include "common.h"
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <iostream>
+
+namespace Communication {
+
+	//
+	// Non-owning view over a run of bytes living in someone else's buffer.
+	//
+	struct Slice {
+		const char *data;
+		std::size_t size;
+		Slice() : data(NULL), size(0) {}
+		Slice(const char *d, std::size_t s) : data(d), size(s) {}
+		bool empty() const {
+			return size == 0;
+		}
+		const char *begin() const {
+			return data;
+		}
+		const char *end() const {
+			return data + size;
+		}
+		char operator[](std::size_t i) const {
+			return data[i];
+		}
+		std::string str() const {
+			return std::string(data, size);
+		}
+		inline friend std::ostream& operator<<(std::ostream& o, const Slice& v) {
+			o.write(v.data, v.size);
+			return o;
+		}
+	};
+
+	//
+	// Splits the received byte stream into `;`-terminated messages.
+	//
+	// Bytes are received straight into a ring of memory, and complete messages
+	// are handed out as slices of it, so nothing is copied or allocated per message.
+	// A message split across reads simply stays pending until its terminator arrives.
+	// When the writer reaches the end of the ring, the pending tail is moved back to
+	// the front (it is at most one partial message), so slices are always contiguous.
+	//
+	// The terminator is overwritten with '\0', which makes every slice a valid C string.
+	// Slices remain valid until the next call to reclaim().
+	//
+	class LineFramer {
+		private:
+			char *m_buffer;
+			std::size_t m_capacity;
+			std::size_t m_head; // first byte not yet handed out
+			std::size_t m_scan; // first byte not yet searched for a terminator
+			std::size_t m_tail; // first free byte
+		public:
+			static const char TERMINATOR = ';';
+
+			LineFramer(std::size_t capacity = 64 * 1024)
+				: m_capacity(capacity), m_head(0), m_scan(0), m_tail(0)
+			{
+				m_buffer = static_cast<char *>(malloc(m_capacity));
+			}
+			~LineFramer() {
+				SAFE_FREE(m_buffer);
+			}
+
+			//
+			// Drops the messages already handed out and makes room at the tail.
+			// Invalidates every slice previously returned by next().
+			//
+			void reclaim() {
+				if (m_head == m_tail) {
+					m_head = m_scan = m_tail = 0;
+				} else if (m_tail == m_capacity) {
+					std::size_t pending = m_tail - m_head;
+					if (m_head > 0) {
+						memmove(m_buffer, m_buffer + m_head, pending);
+					} else {
+						// A single message larger than the whole ring, grow it.
+						m_capacity *= 2;
+						m_buffer = static_cast<char *>(realloc(m_buffer, m_capacity));
+					}
+					m_scan -= m_head;
+					m_head = 0;
+					m_tail = pending;
+				}
+			}
+			char *tail() {
+				return m_buffer + m_tail;
+			}
+			std::size_t space() const {
+				return m_capacity - m_tail;
+			}
+			void commit(std::size_t bytes) {
+				m_tail += bytes;
+			}
+			std::size_t pending() const {
+				return m_tail - m_head;
+			}
+
+			bool next(Slice& message) {
+				// Skip separators left between messages.
+				while (m_head < m_tail && isSeparator(m_buffer[m_head]))
+					++m_head;
+				if (m_scan < m_head)
+					m_scan = m_head;
+				char *found = static_cast<char *>(memchr(m_buffer + m_scan, TERMINATOR, m_tail - m_scan));
+				if (found == NULL) {
+					m_scan = m_tail;
+					return false;
+				}
+				*found = '\0';
+				message.data = m_buffer + m_head;
+				message.size = found - message.data;
+				// Trailing blanks before the terminator are not part of the message.
+				while (message.size > 0 && isSeparator(message.data[message.size-1]))
+					--message.size;
+				m_head = m_scan = (found - m_buffer) + 1;
+				return true;
+			}
+
+		private:
+			static bool isSeparator(char c) {
+				return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\0';
+			}
+	};
+
+}
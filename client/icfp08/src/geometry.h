@@ -0,0 +1,383 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEOMETRY_X86
+#endif
+
+namespace Movement {
+
+	//
+	// Circles as parallel arrays, the way WorldModel and the protocol's
+	// CircleArray keep them, so that the kernels below load a few of them
+	// at once.
+	//
+	struct CircleSet {
+		const float *x;
+		const float *y;
+		const float *r;
+		std::size_t size;
+
+		CircleSet(const std::vector<float>& cx, const std::vector<float>& cy, const std::vector<float>& cr)
+			: x(cx.empty() ? NULL : &cx[0]), y(cy.empty() ? NULL : &cy[0]), r(cr.empty() ? NULL : &cr[0]), size(cx.size())
+		{
+			// nop
+		}
+	};
+
+	//
+	// Batch geometry queries, run on 8 or 4 circles at a time with AVX2 or
+	// SSE2 when the CPU has them, or one at a time otherwise. The choice is
+	// made once, at the first query; ICFP_GEOMETRY=scalar|sse2|avx2 forces it.
+	//
+	// Every variant does the scalar one's arithmetic in the same order, so
+	// the answers do not depend on the CPU (unless the build contracts them
+	// into fused multiply-adds, which this Makefile's does not).
+	//
+	struct GeometryKernels {
+		const char *isa;
+		// First circle from `begin` on, grown by `grow`, strictly containing (px, py); `size` if none.
+		std::size_t (*first_overlap)(const CircleSet& c, float px, float py, float grow, std::size_t begin);
+		// Squared distance from (px, py) to the nearest of n points; FLT_MAX if none.
+		float (*nearest_sq)(const float *x, const float *y, std::size_t n, float px, float py);
+		// First circle from `begin` on, grown by `grow`, touching the segment from a to b; `size` if none.
+		std::size_t (*first_segment_hit)(const CircleSet& c, float ax, float ay, float bx, float by, float grow, std::size_t begin);
+		// Distance along the unit direction (dx, dy) to the first circle, grown by
+		// `grow`, the ray enters; 0 if it starts inside one, max_distance if none.
+		float (*ray_cast)(const CircleSet& c, float ox, float oy, float dx, float dy, float grow, float max_distance, std::size_t *index);
+	};
+
+	namespace GeometryScalar {
+
+		inline std::size_t firstOverlap(const CircleSet& c, float px, float py, float grow, std::size_t i) {
+			for (; i < c.size; ++i) {
+				float dx = px - c.x[i], dy = py - c.y[i], reach = c.r[i] + grow;
+				if (dx * dx + dy * dy < reach * reach)
+					return i;
+			}
+			return c.size;
+		}
+
+		inline float nearestSq(const float *x, const float *y, std::size_t n, float px, float py) {
+			float nearest = std::numeric_limits<float>::max();
+			for (std::size_t i = 0; i < n; ++i) {
+				float dx = x[i] - px, dy = y[i] - py;
+				float d2 = dx * dx + dy * dy;
+				nearest = d2 < nearest ? d2 : nearest;
+			}
+			return nearest;
+		}
+
+		// As WorldModel::distanceSqToSegment(), from the circle's center.
+		inline std::size_t firstSegmentHit(const CircleSet& c, float ax, float ay, float bx, float by, float grow, std::size_t i) {
+			float sx = bx - ax, sy = by - ay;
+			float len_sq = sx * sx + sy * sy;
+			for (; i < c.size; ++i) {
+				float t = len_sq > 0.0f ? ((c.x[i] - ax) * sx + (c.y[i] - ay) * sy) / len_sq : 0.0f;
+				t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+				float ex = ax + sx * t - c.x[i], ey = ay + sy * t - c.y[i];
+				float reach = c.r[i] + grow;
+				if (ex * ex + ey * ey <= reach * reach)
+					return i;
+			}
+			return c.size;
+		}
+
+		inline float rayCast(const CircleSet& c, float ox, float oy, float dx, float dy, float grow, float max_distance, std::size_t *index) {
+			float best = max_distance;
+			*index = c.size;
+			for (std::size_t i = 0; i < c.size; ++i) {
+				float cx = c.x[i] - ox, cy = c.y[i] - oy, reach = c.r[i] + grow;
+				float c2 = cx * cx + cy * cy, r2 = reach * reach;
+				if (c2 <= r2) {
+					*index = i;
+					return 0.0f;
+				}
+				float along = cx * dx + cy * dy;
+				float miss = c2 - along * along;
+				if (along <= 0.0f || miss > r2)
+					continue;
+				float t = along - std::sqrt(r2 - miss);
+				if (t < best) {
+					best = t;
+					*index = i;
+				}
+			}
+			return best;
+		}
+
+	}
+
+#ifdef GEOMETRY_X86
+	namespace GeometrySse2 {
+
+		__attribute__((target("sse2")))
+		inline std::size_t firstOverlap(const CircleSet& c, float px, float py, float grow, std::size_t i) {
+			__m128 vpx = _mm_set1_ps(px), vpy = _mm_set1_ps(py), vgrow = _mm_set1_ps(grow);
+			for (; i + 4 <= c.size; i += 4) {
+				__m128 dx = _mm_sub_ps(vpx, _mm_loadu_ps(c.x + i));
+				__m128 dy = _mm_sub_ps(vpy, _mm_loadu_ps(c.y + i));
+				__m128 reach = _mm_add_ps(_mm_loadu_ps(c.r + i), vgrow);
+				__m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+				int hits = _mm_movemask_ps(_mm_cmplt_ps(d2, _mm_mul_ps(reach, reach)));
+				if (hits != 0)
+					return i + __builtin_ctz(hits);
+			}
+			return GeometryScalar::firstOverlap(c, px, py, grow, i);
+		}
+
+		__attribute__((target("sse2")))
+		inline float nearestSq(const float *x, const float *y, std::size_t n, float px, float py) {
+			__m128 vpx = _mm_set1_ps(px), vpy = _mm_set1_ps(py);
+			__m128 nearest = _mm_set1_ps(std::numeric_limits<float>::max());
+			std::size_t i = 0;
+			for (; i + 4 <= n; i += 4) {
+				__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), vpx);
+				__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), vpy);
+				nearest = _mm_min_ps(nearest, _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+			}
+			float lanes[4];
+			_mm_storeu_ps(lanes, nearest);
+			float tail = GeometryScalar::nearestSq(x + i, y + i, n - i, px, py);
+			for (int k = 0; k < 4; ++k)
+				tail = lanes[k] < tail ? lanes[k] : tail;
+			return tail;
+		}
+
+		__attribute__((target("sse2")))
+		inline std::size_t firstSegmentHit(const CircleSet& c, float ax, float ay, float bx, float by, float grow, std::size_t i) {
+			float sx = bx - ax, sy = by - ay;
+			float len_sq = sx * sx + sy * sy;
+			__m128 vax = _mm_set1_ps(ax), vay = _mm_set1_ps(ay), vsx = _mm_set1_ps(sx), vsy = _mm_set1_ps(sy);
+			__m128 vlen = _mm_set1_ps(len_sq), vgrow = _mm_set1_ps(grow);
+			__m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+			for (; i + 4 <= c.size; i += 4) {
+				__m128 cx = _mm_loadu_ps(c.x + i), cy = _mm_loadu_ps(c.y + i);
+				__m128 t = zero;
+				if (len_sq > 0.0f) {
+					__m128 dot = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(cx, vax), vsx), _mm_mul_ps(_mm_sub_ps(cy, vay), vsy));
+					t = _mm_max_ps(zero, _mm_min_ps(one, _mm_div_ps(dot, vlen)));
+				}
+				__m128 ex = _mm_sub_ps(_mm_add_ps(vax, _mm_mul_ps(vsx, t)), cx);
+				__m128 ey = _mm_sub_ps(_mm_add_ps(vay, _mm_mul_ps(vsy, t)), cy);
+				__m128 reach = _mm_add_ps(_mm_loadu_ps(c.r + i), vgrow);
+				__m128 d2 = _mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey));
+				int hits = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_mul_ps(reach, reach)));
+				if (hits != 0)
+					return i + __builtin_ctz(hits);
+			}
+			return GeometryScalar::firstSegmentHit(c, ax, ay, bx, by, grow, i);
+		}
+
+		__attribute__((target("sse2")))
+		inline float rayCast(const CircleSet& c, float ox, float oy, float dx, float dy, float grow, float max_distance, std::size_t *index) {
+			__m128 vox = _mm_set1_ps(ox), voy = _mm_set1_ps(oy), vdx = _mm_set1_ps(dx), vdy = _mm_set1_ps(dy);
+			__m128 vgrow = _mm_set1_ps(grow), zero = _mm_setzero_ps(), none = _mm_set1_ps(std::numeric_limits<float>::infinity());
+			float best = max_distance;
+			*index = c.size;
+			std::size_t i = 0;
+			for (; i + 4 <= c.size; i += 4) {
+				__m128 cx = _mm_sub_ps(_mm_loadu_ps(c.x + i), vox);
+				__m128 cy = _mm_sub_ps(_mm_loadu_ps(c.y + i), voy);
+				__m128 reach = _mm_add_ps(_mm_loadu_ps(c.r + i), vgrow);
+				__m128 c2 = _mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy));
+				__m128 r2 = _mm_mul_ps(reach, reach);
+				int inside = _mm_movemask_ps(_mm_cmple_ps(c2, r2));
+				if (inside != 0) {
+					*index = i + __builtin_ctz(inside);
+					return 0.0f;
+				}
+				__m128 along = _mm_add_ps(_mm_mul_ps(cx, vdx), _mm_mul_ps(cy, vdy));
+				__m128 miss = _mm_sub_ps(c2, _mm_mul_ps(along, along));
+				__m128 hit = _mm_and_ps(_mm_cmpgt_ps(along, zero), _mm_cmple_ps(miss, r2));
+				if (_mm_movemask_ps(hit) == 0)
+					continue;
+				__m128 t = _mm_sub_ps(along, _mm_sqrt_ps(_mm_max_ps(zero, _mm_sub_ps(r2, miss))));
+				t = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, none));
+				float lanes[4];
+				_mm_storeu_ps(lanes, t);
+				for (int k = 0; k < 4; ++k) {
+					if (lanes[k] < best) {
+						best = lanes[k];
+						*index = i + k;
+					}
+				}
+			}
+			std::size_t tail_index;
+			CircleSet tail = c;
+			tail.x += i;
+			tail.y += i;
+			tail.r += i;
+			tail.size -= i;
+			float t = GeometryScalar::rayCast(tail, ox, oy, dx, dy, grow, best, &tail_index);
+			if (tail_index < tail.size) {
+				*index = i + tail_index;
+				return t;
+			}
+			return best;
+		}
+
+	}
+
+	namespace GeometryAvx2 {
+
+		__attribute__((target("avx2")))
+		inline std::size_t firstOverlap(const CircleSet& c, float px, float py, float grow, std::size_t i) {
+			__m256 vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py), vgrow = _mm256_set1_ps(grow);
+			for (; i + 8 <= c.size; i += 8) {
+				__m256 dx = _mm256_sub_ps(vpx, _mm256_loadu_ps(c.x + i));
+				__m256 dy = _mm256_sub_ps(vpy, _mm256_loadu_ps(c.y + i));
+				__m256 reach = _mm256_add_ps(_mm256_loadu_ps(c.r + i), vgrow);
+				__m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+				int hits = _mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_mul_ps(reach, reach), _CMP_LT_OQ));
+				if (hits != 0)
+					return i + __builtin_ctz(hits);
+			}
+			return GeometryScalar::firstOverlap(c, px, py, grow, i);
+		}
+
+		__attribute__((target("avx2")))
+		inline float nearestSq(const float *x, const float *y, std::size_t n, float px, float py) {
+			__m256 vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py);
+			__m256 nearest = _mm256_set1_ps(std::numeric_limits<float>::max());
+			std::size_t i = 0;
+			for (; i + 8 <= n; i += 8) {
+				__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), vpx);
+				__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), vpy);
+				nearest = _mm256_min_ps(nearest, _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+			}
+			float lanes[8];
+			_mm256_storeu_ps(lanes, nearest);
+			float tail = GeometryScalar::nearestSq(x + i, y + i, n - i, px, py);
+			for (int k = 0; k < 8; ++k)
+				tail = lanes[k] < tail ? lanes[k] : tail;
+			return tail;
+		}
+
+		__attribute__((target("avx2")))
+		inline std::size_t firstSegmentHit(const CircleSet& c, float ax, float ay, float bx, float by, float grow, std::size_t i) {
+			float sx = bx - ax, sy = by - ay;
+			float len_sq = sx * sx + sy * sy;
+			__m256 vax = _mm256_set1_ps(ax), vay = _mm256_set1_ps(ay), vsx = _mm256_set1_ps(sx), vsy = _mm256_set1_ps(sy);
+			__m256 vlen = _mm256_set1_ps(len_sq), vgrow = _mm256_set1_ps(grow);
+			__m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+			for (; i + 8 <= c.size; i += 8) {
+				__m256 cx = _mm256_loadu_ps(c.x + i), cy = _mm256_loadu_ps(c.y + i);
+				__m256 t = zero;
+				if (len_sq > 0.0f) {
+					__m256 dot = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(cx, vax), vsx), _mm256_mul_ps(_mm256_sub_ps(cy, vay), vsy));
+					t = _mm256_max_ps(zero, _mm256_min_ps(one, _mm256_div_ps(dot, vlen)));
+				}
+				__m256 ex = _mm256_sub_ps(_mm256_add_ps(vax, _mm256_mul_ps(vsx, t)), cx);
+				__m256 ey = _mm256_sub_ps(_mm256_add_ps(vay, _mm256_mul_ps(vsy, t)), cy);
+				__m256 reach = _mm256_add_ps(_mm256_loadu_ps(c.r + i), vgrow);
+				__m256 d2 = _mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey));
+				int hits = _mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_mul_ps(reach, reach), _CMP_LE_OQ));
+				if (hits != 0)
+					return i + __builtin_ctz(hits);
+			}
+			return GeometrySse2::firstSegmentHit(c, ax, ay, bx, by, grow, i);
+		}
+
+		__attribute__((target("avx2")))
+		inline float rayCast(const CircleSet& c, float ox, float oy, float dx, float dy, float grow, float max_distance, std::size_t *index) {
+			__m256 vox = _mm256_set1_ps(ox), voy = _mm256_set1_ps(oy), vdx = _mm256_set1_ps(dx), vdy = _mm256_set1_ps(dy);
+			__m256 vgrow = _mm256_set1_ps(grow), zero = _mm256_setzero_ps(), none = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+			float best = max_distance;
+			*index = c.size;
+			std::size_t i = 0;
+			for (; i + 8 <= c.size; i += 8) {
+				__m256 cx = _mm256_sub_ps(_mm256_loadu_ps(c.x + i), vox);
+				__m256 cy = _mm256_sub_ps(_mm256_loadu_ps(c.y + i), voy);
+				__m256 reach = _mm256_add_ps(_mm256_loadu_ps(c.r + i), vgrow);
+				__m256 c2 = _mm256_add_ps(_mm256_mul_ps(cx, cx), _mm256_mul_ps(cy, cy));
+				__m256 r2 = _mm256_mul_ps(reach, reach);
+				int inside = _mm256_movemask_ps(_mm256_cmp_ps(c2, r2, _CMP_LE_OQ));
+				if (inside != 0) {
+					*index = i + __builtin_ctz(inside);
+					return 0.0f;
+				}
+				__m256 along = _mm256_add_ps(_mm256_mul_ps(cx, vdx), _mm256_mul_ps(cy, vdy));
+				__m256 miss = _mm256_sub_ps(c2, _mm256_mul_ps(along, along));
+				__m256 hit = _mm256_and_ps(_mm256_cmp_ps(along, zero, _CMP_GT_OQ), _mm256_cmp_ps(miss, r2, _CMP_LE_OQ));
+				if (_mm256_movemask_ps(hit) == 0)
+					continue;
+				__m256 t = _mm256_sub_ps(along, _mm256_sqrt_ps(_mm256_max_ps(zero, _mm256_sub_ps(r2, miss))));
+				t = _mm256_blendv_ps(none, t, hit);
+				float lanes[8];
+				_mm256_storeu_ps(lanes, t);
+				for (int k = 0; k < 8; ++k) {
+					if (lanes[k] < best) {
+						best = lanes[k];
+						*index = i + k;
+					}
+				}
+			}
+			std::size_t tail_index;
+			CircleSet tail = c;
+			tail.x += i;
+			tail.y += i;
+			tail.r += i;
+			tail.size -= i;
+			float t = GeometrySse2::rayCast(tail, ox, oy, dx, dy, grow, best, &tail_index);
+			if (tail_index < tail.size) {
+				*index = i + tail_index;
+				return t;
+			}
+			return best;
+		}
+
+	}
+#endif
+
+	inline GeometryKernels selectGeometryKernels() {
+		GeometryKernels scalar = { "scalar", GeometryScalar::firstOverlap, GeometryScalar::nearestSq,
+			GeometryScalar::firstSegmentHit, GeometryScalar::rayCast };
+#ifdef GEOMETRY_X86
+		GeometryKernels sse2 = { "sse2", GeometrySse2::firstOverlap, GeometrySse2::nearestSq,
+			GeometrySse2::firstSegmentHit, GeometrySse2::rayCast };
+		GeometryKernels avx2 = { "avx2", GeometryAvx2::firstOverlap, GeometryAvx2::nearestSq,
+			GeometryAvx2::firstSegmentHit, GeometryAvx2::rayCast };
+		__builtin_cpu_init();
+		bool has_sse2 = __builtin_cpu_supports("sse2");
+		bool has_avx2 = has_sse2 && __builtin_cpu_supports("avx2");
+		const char *forced = getenv("ICFP_GEOMETRY");
+		if (forced != NULL) {
+			if (strcmp(forced, "avx2") == 0 && has_avx2)
+				return avx2;
+			if (strcmp(forced, "sse2") == 0 && has_sse2)
+				return sse2;
+			return scalar;
+		}
+		if (has_avx2)
+			return avx2;
+		if (has_sse2)
+			return sse2;
+#endif
+		return scalar;
+	}
+
+	inline const GeometryKernels& geometryKernels() {
+		static const GeometryKernels kernels = selectGeometryKernels();
+		return kernels;
+	}
+
+	inline std::size_t firstOverlap(const CircleSet& c, float px, float py, float grow, std::size_t begin = 0) {
+		return geometryKernels().first_overlap(c, px, py, grow, begin);
+	}
+	inline float nearestSq(const float *x, const float *y, std::size_t n, float px, float py) {
+		return geometryKernels().nearest_sq(x, y, n, px, py);
+	}
+	inline std::size_t firstSegmentHit(const CircleSet& c, float ax, float ay, float bx, float by, float grow, std::size_t begin = 0) {
+		return geometryKernels().first_segment_hit(c, ax, ay, bx, by, grow, begin);
+	}
+	inline float rayCast(const CircleSet& c, float ox, float oy, float dx, float dy, float grow, float max_distance, std::size_t *index) {
+		return geometryKernels().ray_cast(c, ox, oy, dx, dy, grow, max_distance, index);
+	}
+
+}
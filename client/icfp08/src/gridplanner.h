@@ -0,0 +1,239 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <ctime>
+#include <limits>
+#include "vector2.h"
+#include "occupancy.h"
+#include "indexedheap.h"
+
+namespace Movement {
+
+	// 8-connected neighborhood of a grid cell and the cost of each step (cells).
+	const int NEIGHBOR_DX[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+	const int NEIGHBOR_DY[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+	const float NEIGHBOR_COST[8] = { 1.0f, 1.0f, 1.0f, 1.0f, 1.41421356f, 1.41421356f, 1.41421356f, 1.41421356f };
+
+	//
+	// Cells a search is confined to, for planners that narrow it down: the
+	// ones whose mark is the current stamp. Bumping the stamp empties it.
+	//
+	struct Corridor {
+		std::vector<unsigned> marks; // per grid cell
+		unsigned stamp;
+
+		Corridor() : stamp(0) {
+			// nop
+		}
+		bool contains(int v) const {
+			return marks[v] == stamp;
+		}
+	};
+
+	//
+	// Any-angle (Theta*) or plain 8-connected A* search over an OccupancyGrid.
+	//
+	// Every per-node array and the open list are sized once per grid and reused
+	// by all searches; a search stamp tells which entries belong to the current
+	// search, so steady-state planning does not allocate nor clear anything.
+	//
+	// Searches are bounded by a time budget. When it runs out, the path leads to
+	// the expanded node closest to the goal, so the rover keeps making progress
+	// and the next tick searches again from wherever it got.
+	//
+	class GridPlanner {
+		public:
+			enum Result {
+				NO_PATH,
+				PARTIAL_PATH,
+				FOUND_PATH
+			};
+
+			GridPlanner() : m_any_angle(true), m_budget_usec(20000), m_stamp(0), m_expanded(0) {
+				// nop
+			}
+
+			void setAnyAngle(bool any_angle) {
+				m_any_angle = any_angle;
+			}
+			void setBudget(long usec) {
+				m_budget_usec = usec;
+			}
+			long budget() const {
+				return m_budget_usec;
+			}
+			// Nodes expanded by the last search.
+			int expanded() const {
+				return m_expanded;
+			}
+			// Waypoints of the last search, from start to goal.
+			const std::vector<Vector2>& path() const {
+				return m_path;
+			}
+
+			//
+			// Searches from `from` to `to`, expanding only the cells of `corridor`
+			// (besides the start and goal) if given.
+			//
+			Result plan(const OccupancyGrid& grid, const Vector2& from, const Vector2& to, const Corridor *corridor = NULL) {
+				m_path.clear();
+				m_expanded = 0;
+				if (grid.empty())
+					return NO_PATH;
+				prepare(grid);
+
+				int width = grid.width();
+				int start = grid.cellY(from.y) * width + grid.cellX(from.x);
+				int goal = grid.cellY(to.y) * width + grid.cellX(to.x);
+				int goal_i = goal % width, goal_j = goal / width;
+
+				struct timespec deadline;
+				deadlineAfter(m_budget_usec, deadline);
+
+				touch(start);
+				m_g[start] = 0.0f;
+				m_parent[start] = start;
+				m_open.push(start, heuristic(start, goal_i, goal_j, width));
+				int best = start;
+				float best_h = heuristic(start, goal_i, goal_j, width);
+				Result result = NO_PATH;
+
+				while (!m_open.empty()) {
+					int u = m_open.pop();
+					m_closed[u] = m_stamp;
+					++m_expanded;
+					if (u == goal) {
+						best = goal;
+						result = FOUND_PATH;
+						break;
+					}
+					float h = heuristic(u, goal_i, goal_j, width);
+					if (h < best_h) {
+						best_h = h;
+						best = u;
+					}
+					if ((m_expanded & 63) == 0 && expired(deadline)) {
+						result = PARTIAL_PATH;
+						break;
+					}
+					int ui = u % width, uj = u / width;
+					for (int k = 0; k < 8; ++k) {
+						int vi = ui + NEIGHBOR_DX[k], vj = uj + NEIGHBOR_DY[k];
+						if (!grid.contains(vi, vj))
+							continue;
+						int v = vj * width + vi;
+						// The goal may sit inside an inflated obstacle (home is
+						// reached by touching it), everything else must be free.
+						if (v != goal && (grid.blocked(vi, vj) || (corridor != NULL && !corridor->contains(v))))
+							continue;
+						// Do not cut corners between two blocked cells.
+						if (NEIGHBOR_DX[k] != 0 && NEIGHBOR_DY[k] != 0
+							&& (grid.blocked(ui + NEIGHBOR_DX[k], uj) || grid.blocked(ui, uj + NEIGHBOR_DY[k])))
+							continue;
+						touch(v);
+						if (m_closed[v] == m_stamp)
+							continue;
+						int p = m_parent[u];
+						float g;
+						int parent;
+						if (m_any_angle && p != u && grid.lineOfSight(p, v)) {
+							g = m_g[p] + distance(p, v, width);
+							parent = p;
+						} else {
+							g = m_g[u] + NEIGHBOR_COST[k];
+							parent = u;
+						}
+						if (g < m_g[v]) {
+							m_g[v] = g;
+							m_parent[v] = parent;
+							m_open.push(v, g + heuristic(v, goal_i, goal_j, width) * 1.001f);
+						}
+					}
+				}
+				if (result == NO_PATH && best != start)
+					result = PARTIAL_PATH;
+				if (result != NO_PATH)
+					buildPath(grid, best, start, from, result == FOUND_PATH ? &to : NULL);
+				return result;
+			}
+
+		private:
+			void prepare(const OccupancyGrid& grid) {
+				std::size_t nodes = grid.width() * grid.height();
+				if (m_g.size() != nodes) {
+					m_g.assign(nodes, 0.0f);
+					m_parent.assign(nodes, -1);
+					m_seen.assign(nodes, 0);
+					m_closed.assign(nodes, 0);
+					m_open.resize(nodes);
+					m_stamp = 0;
+				}
+				if (++m_stamp == 0) {
+					// Wrapped around, old stamps could collide with the new ones.
+					std::fill(m_seen.begin(), m_seen.end(), 0);
+					std::fill(m_closed.begin(), m_closed.end(), 0);
+					m_stamp = 1;
+				}
+				m_open.clear();
+			}
+
+			// Lazily resets a node the first time the current search sees it.
+			void touch(int v) {
+				if (m_seen[v] != m_stamp) {
+					m_seen[v] = m_stamp;
+					m_g[v] = std::numeric_limits<float>::max();
+					m_parent[v] = -1;
+				}
+			}
+
+			static float distance(int a, int b, int width) {
+				float dx = static_cast<float>(a % width - b % width);
+				float dy = static_cast<float>(a / width - b / width);
+				return std::sqrt(dx * dx + dy * dy);
+			}
+			static float heuristic(int v, int goal_i, int goal_j, int width) {
+				float dx = static_cast<float>(v % width - goal_i);
+				float dy = static_cast<float>(v / width - goal_j);
+				return std::sqrt(dx * dx + dy * dy);
+			}
+
+			void buildPath(const OccupancyGrid& grid, int last, int start, const Vector2& from, const Vector2 *to) {
+				int width = grid.width();
+				for (int v = last; v != start; v = m_parent[v])
+					m_path.push_back(grid.center(v % width, v / width));
+				m_path.push_back(from);
+				std::reverse(m_path.begin(), m_path.end());
+				if (to != NULL)
+					m_path.back() = *to;
+			}
+
+			static void deadlineAfter(long usec, struct timespec& deadline) {
+				clock_gettime(CLOCK_MONOTONIC, &deadline);
+				deadline.tv_sec += usec / 1000000;
+				deadline.tv_nsec += (usec % 1000000) * 1000;
+				if (deadline.tv_nsec >= 1000000000) {
+					deadline.tv_nsec -= 1000000000;
+					++deadline.tv_sec;
+				}
+			}
+			static bool expired(const struct timespec& deadline) {
+				struct timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				return now.tv_sec > deadline.tv_sec
+					|| (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec);
+			}
+
+			bool m_any_angle;
+			long m_budget_usec;
+			unsigned m_stamp;
+			std::vector<float> m_g;
+			std::vector<int> m_parent;
+			std::vector<unsigned> m_seen;
+			std::vector<unsigned> m_closed;
+			IndexedHeap<float> m_open;
+			int m_expanded;
+			std::vector<Vector2> m_path;
+	};
+
+}
@@ -0,0 +1,103 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include "headless.h"
+
+using namespace Simulation;
+
+//
+// Plays the runs of a map against the controller in-process, trial after
+// trial, and tells how they went and how long the planner took per tick.
+// With -e it also fails unless every run made it home, for `make check`.
+//
+
+static void usage() {
+	fprintf(stderr, "usage: icfpHeadless [-r runs] [-t trials] [-s seed] [-b budget_usec] [-p planner] [-n] [-w world_file] [-v] [-e] <map.wrld>\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	int runs = 0;
+	int trials = 1;
+	unsigned seed = 0;
+	long budget = HEADLESS_PLANNING_BUDGET;
+	PathFind::Planner planner = PathFind::INCREMENTAL;
+	bool local_planning = true;
+	const char *world_file = NULL;
+	bool verbose = false;
+	bool strict = false; // fail unless every run succeeds
+	int opt;
+	while ((opt = getopt(argc, argv, "r:t:s:b:p:nw:ve")) != -1) {
+		switch (opt) {
+			case 'r': runs = atoi(optarg); break;
+			case 't': trials = atoi(optarg); break;
+			case 's': seed = static_cast<unsigned>(strtoul(optarg, NULL, 10)); break;
+			case 'b': budget = atol(optarg); break;
+			case 'p': if (!PathFind::plannerNamed(optarg, planner)) usage(); break;
+			case 'n': local_planning = false; break;
+			case 'w': world_file = optarg; break;
+			case 'v': verbose = true; break;
+			case 'e': strict = true; break;
+			default: usage();
+		}
+	}
+	if (optind != argc - 1 || trials <= 0)
+		usage();
+
+	WorldMap map;
+	std::string error;
+	if (!map.load(argv[optind], error)) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+	if (runs <= 0)
+		runs = static_cast<int>(map.runs.size());
+	// The controller's tracing is only worth its cost when asked for.
+	if (verbose)
+		Logger::instance().start(stdout);
+
+	// Each trial is a fresh controller, which starts from what the ones before it saved.
+	Movement::WorldStore world_store;
+	if (world_file != NULL && !world_store.open(world_file))
+		return 1;
+
+	HeadlessTrial trial(map);
+	trial.setPlanningBudget(budget);
+	trial.setPlanner(planner);
+	trial.setLocalPlanning(local_planning);
+	if (world_store.isOpen())
+		trial.setWorldStore(&world_store);
+	std::vector<RunResult> results;
+	int outcomes[5] = { 0, 0, 0, 0, 0 };
+	long long score = 0, simulated_ms = 0;
+	struct timespec started, finished;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+	for (int t = 0; t < trials; ++t) {
+		results.clear();
+		trial.play(runs, seed + t, results);
+		for (std::size_t i = 0; i < results.size(); ++i) {
+			const RunResult& r = results[i];
+			printf("seed %u run %d: %s at %d ms, score %d, %d crashes\n",
+				r.seed, r.run, HeadlessTrial::outcomeName(r.outcome), r.time, r.score, r.crashes);
+			++outcomes[r.outcome];
+			score += r.score;
+			simulated_ms += r.time;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &finished);
+	Logger::instance().stop();
+	double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) * 1e-9;
+
+	int total = runs * trials;
+	printf("%d runs: %d success, %d crater, %d killed, %d timeout; mean score %lld ms\n",
+		total, outcomes[Simulator::SUCCESS], outcomes[Simulator::CRATER],
+		outcomes[Simulator::KILLED], outcomes[Simulator::TIMEOUT], score / total);
+	printf("%.1f s simulated in %.1f s (%.0fx), %ld ticks, %lld usec per tick on average, %ld at most\n",
+		simulated_ms * 0.001, seconds, seconds > 0.0 ? simulated_ms * 0.001 / seconds : 0.0,
+		trial.ticks(), trial.ticks() > 0 ? trial.tickUsec() / trial.ticks() : 0, trial.maxTickUsec());
+	return strict && outcomes[Simulator::SUCCESS] != total ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <vector>
+#include <ctime>
+#include "protocol.h"
+#include "movement.h"
+#include "pathfind.h"
+#include "simulator.h"
+
+namespace Simulation {
+
+	using Communication::OutgoingCommand;
+	using Movement::Controller;
+	using Movement::PathFind;
+
+	// Generous enough for every search to finish, which keeps runs reproducible.
+	const long HEADLESS_PLANNING_BUDGET = 1000000; // microseconds
+
+	struct RunResult {
+		unsigned seed;
+		int run;
+		Simulator::Outcome outcome;
+		int time; // milliseconds
+		int score; // as in the end of run message
+		int crashes;
+	};
+
+	//
+	// Drives the Controller/PathFind stack with an in-process Simulator: the
+	// messages go straight to the ControllerState and the commands straight
+	// back to the simulator, with no socket nor text in between. Simulated
+	// time only advances once the planner is done with a telemetry message,
+	// so the results depend on the map, the seed and the code alone.
+	//
+	// An instance belongs to one thread; instances share nothing but the map.
+	//
+	class HeadlessTrial {
+		public:
+			HeadlessTrial(const WorldMap& map) : m_sim(map, onMessage, this), m_controller(NULL), m_telemetry(false),
+				m_budget(HEADLESS_PLANNING_BUDGET), m_planner(PathFind::INCREMENTAL), m_local_threads(-1), m_local_planning(true), m_world_store(NULL), m_ticks(0), m_tick_usec(0), m_max_tick_usec(0)
+			{
+				// nop
+			}
+
+			// Time budget of the path searches (microseconds).
+			void setPlanningBudget(long usec) {
+				m_budget = usec;
+			}
+			void setPlanner(PathFind::Planner planner) {
+				m_planner = planner;
+			}
+			// Threads helping the local planner, -1 for one per spare core.
+			void setLocalThreads(int threads) {
+				m_local_threads = threads;
+			}
+			// Steer with the local planner rollouts, or head for the next waypoint.
+			void setLocalPlanning(bool enabled) {
+				m_local_planning = enabled;
+			}
+			// Where each fresh controller loads and saves the obstacles, NULL for nowhere.
+			void setWorldStore(Movement::WorldStore *store) {
+				m_world_store = store;
+			}
+
+			//
+			// Plays the first `runs` runs of the map with a fresh controller, as
+			// a new connection to the server would, and appends their results.
+			//
+			void play(int runs, unsigned seed, std::vector<RunResult>& results) {
+				Controller controller(onCommand, this);
+				controller.state().setRealTime(false);
+				controller.state().setWorldStore(m_world_store);
+				PathFind path_finder(&controller, false, m_local_threads);
+				path_finder.setPlanningBudget(m_budget);
+				path_finder.setPlanner(m_planner);
+				path_finder.setLocalPlanning(m_local_planning);
+				m_controller = &controller;
+				m_sim.initialization();
+				for (int run = 0; run < runs; ++run) {
+					m_sim.start(run, seed);
+					while (!m_sim.ended()) {
+						m_telemetry = false;
+						m_sim.step();
+						if (!m_telemetry || m_sim.ended())
+							continue;
+						struct timespec started, finished;
+						clock_gettime(CLOCK_MONOTONIC, &started);
+						path_finder.adjustCourse();
+						clock_gettime(CLOCK_MONOTONIC, &finished);
+						long usec = (finished.tv_sec - started.tv_sec) * 1000000 + (finished.tv_nsec - started.tv_nsec) / 1000;
+						++m_ticks;
+						m_tick_usec += usec;
+						if (usec > m_max_tick_usec)
+							m_max_tick_usec = usec;
+					}
+					RunResult result = { seed, run, m_sim.outcome(), m_sim.time(), m_sim.score(), m_sim.crashes() };
+					results.push_back(result);
+				}
+				controller.state().saveWorld();
+				m_controller = NULL;
+			}
+
+			// Planner ticks so far, and the wall-clock time they took (microseconds).
+			long ticks() const {
+				return m_ticks;
+			}
+			long long tickUsec() const {
+				return m_tick_usec;
+			}
+			long maxTickUsec() const {
+				return m_max_tick_usec;
+			}
+
+			static const char *outcomeName(Simulator::Outcome outcome) {
+				static const char *names[] = { "running", "success", "crater", "killed", "timeout" };
+				return names[outcome];
+			}
+
+		private:
+			// The simulator sent a message: hand it to the controller as the I/O thread would.
+			static void onMessage(void *context, const Protocol::Message& message) {
+				HeadlessTrial *trial = static_cast<HeadlessTrial *>(context);
+				if (trial->m_controller == NULL)
+					return;
+				trial->m_controller->state().update(message);
+				if (message.tag == Protocol::TAG_TELEMETRY_STREAM)
+					trial->m_telemetry = true;
+			}
+
+			// The controller changed the control state: apply the command it would have sent.
+			static bool onCommand(void *context, int move_from, int turn_from, int move_to, int turn_to) {
+				HeadlessTrial *trial = static_cast<HeadlessTrial *>(context);
+				char text[OutgoingCommand::MAX_TEXT];
+				std::size_t length = OutgoingCommand::commands(move_from, turn_from, move_to, turn_to, text);
+				for (std::size_t begin = 0, end = 0; end < length; begin = ++end) {
+					while (text[end] != ';')
+						++end;
+					trial->m_sim.command(text + begin, end - begin);
+				}
+				return true;
+			}
+
+			Simulator m_sim;
+			Controller *m_controller; // while playing
+			bool m_telemetry; // sent during the current step
+			long m_budget;
+			PathFind::Planner m_planner;
+			int m_local_threads;
+			bool m_local_planning;
+			Movement::WorldStore *m_world_store;
+			long m_ticks;
+			long long m_tick_usec;
+			long m_max_tick_usec;
+	};
+
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+namespace Movement {
+
+	//
+	// Binary min-heap of node indices in [0, nodes), each queued at most once,
+	// supporting key updates and removal by index. Storage is sized by resize()
+	// and never grows afterwards, so planners can push and pop without allocating.
+	//
+	template <typename Key>
+	class IndexedHeap {
+		private:
+			std::vector<int> m_heap;
+			std::vector<int> m_pos; // position of each node in m_heap, or -1
+			std::vector<Key> m_key;
+			int m_size;
+		public:
+			IndexedHeap() : m_size(0) {
+				// nop
+			}
+			void resize(std::size_t nodes) {
+				m_heap.assign(nodes, 0);
+				m_pos.assign(nodes, -1);
+				m_key.assign(nodes, Key());
+				m_size = 0;
+			}
+			// Empties the heap in O(queued nodes).
+			void clear() {
+				for (int i = 0; i < m_size; ++i)
+					m_pos[m_heap[i]] = -1;
+				m_size = 0;
+			}
+			bool empty() const {
+				return m_size == 0;
+			}
+			int size() const {
+				return m_size;
+			}
+			bool contains(int v) const {
+				return m_pos[v] != -1;
+			}
+			int top() const {
+				return m_heap[0];
+			}
+			const Key& topKey() const {
+				return m_key[m_heap[0]];
+			}
+			const Key& key(int v) const {
+				return m_key[v];
+			}
+			// Queues v, or moves it to its new place if it is already queued.
+			void push(int v, const Key& key) {
+				int pos = m_pos[v];
+				if (pos == -1) {
+					pos = m_size++;
+					m_heap[pos] = v;
+					m_pos[v] = pos;
+					m_key[v] = key;
+					siftUp(pos);
+				} else {
+					m_key[v] = key;
+					siftDown(siftUp(pos));
+				}
+			}
+			int pop() {
+				int v = m_heap[0];
+				remove(v);
+				return v;
+			}
+			void remove(int v) {
+				int pos = m_pos[v];
+				if (pos == -1)
+					return;
+				m_pos[v] = -1;
+				if (--m_size == pos)
+					return;
+				m_heap[pos] = m_heap[m_size];
+				m_pos[m_heap[pos]] = pos;
+				siftDown(siftUp(pos));
+			}
+		private:
+			int siftUp(int pos) {
+				int v = m_heap[pos];
+				while (pos > 0) {
+					int parent = (pos - 1) / 2;
+					if (!(m_key[v] < m_key[m_heap[parent]]))
+						break;
+					m_heap[pos] = m_heap[parent];
+					m_pos[m_heap[pos]] = pos;
+					pos = parent;
+				}
+				m_heap[pos] = v;
+				m_pos[v] = pos;
+				return pos;
+			}
+			int siftDown(int pos) {
+				int v = m_heap[pos];
+				while (true) {
+					int child = 2 * pos + 1;
+					if (child >= m_size)
+						break;
+					if (child + 1 < m_size && m_key[m_heap[child + 1]] < m_key[m_heap[child]])
+						++child;
+					if (!(m_key[m_heap[child]] < m_key[v]))
+						break;
+					m_heap[pos] = m_heap[child];
+					m_pos[m_heap[pos]] = pos;
+					pos = child;
+				}
+				m_heap[pos] = v;
+				m_pos[v] = pos;
+				return pos;
+			}
+	};
+
+}
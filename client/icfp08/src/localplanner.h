@@ -0,0 +1,276 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <ctime>
+#include <limits>
+#include <algorithm>
+#include "vector2.h"
+#include "occupancy.h"
+#include "worldmodel.h"
+#include "geometry.h"
+#include "workerpool.h"
+#include "movement.h"
+
+namespace Movement {
+
+	const int LOCAL_HORIZON_STEPS = 15; // command periods simulated per candidate
+	const int LOCAL_SWITCH_STEP = 4; // period at which a candidate switches to its second command
+	const float LOCAL_MIN_LOOKAHEAD = 0.25f; // fraction of the top speed aimed ahead, at least
+	const int LOCAL_CHUNK = 16; // candidates claimed at once by a worker
+	const float COLLISION_COST = 1000.0f; // added to trajectories running into an obstacle
+	const float MARTIAN_COST = 50.0f; // per meter of clearance missing around Martians
+	const float HEADING_COST = 0.5f; // for ending up facing away from the path ahead
+	const float CROSS_TRACK_COST = 0.2f; // per meter off the global path, past a grid cell
+	const float CLEARANCE_COST = 0.2f; // per meter closer than CLEARANCE_WANTED to the inflated obstacles
+	const float CLEARANCE_WANTED = 1.0f; // meters
+	const float LOCAL_OBSTACLE_SLACK = 2.0f; // meters past the horizon obstacles are gathered from
+
+	//
+	// Local trajectory optimizer over the rover's control states.
+	//
+	// Every candidate holds one control state (move and turn) for the first
+	// few command periods and another one for the rest of the horizon, which
+	// covers going straight, turning, straightening up and braking in between.
+	// Candidates are rolled out with the VehicleModel in batches spread over a
+	// WorkerPool, each scored by obstacle collisions and clearance, clearance
+	// from the predicted Martians and how far down the global path it ends.
+	// The best one's first command is taken.
+	//
+	// Collisions are checked against the WorldModel's exact circles within
+	// reach of the horizon, not the occupancy grid: a rollout collides when
+	// the vehicle itself would touch one, and the safety margin the global
+	// planners keep is only wanted through the clearance cost. Every global
+	// planner's path is then feasible here, including the visibility
+	// planner's tangents, which the grid's whole blocked cells would reject.
+	// The clearance cost is read off the grid's distance layer instead, one
+	// lookup a step rather than a pass over the nearby circles.
+	//
+	class LocalPlanner {
+		public:
+			struct Result {
+				bool found; // false if every candidate collides
+				VehicleCommand command; // first command of the best candidate
+				float cost;
+				float clearance; // from the Martians, along the best candidate (meters)
+				int candidates;
+				long usec;
+			};
+
+			LocalPlanner(int threads) : m_pool(threads), m_dt(0.1f), m_martians(NULL), m_grid(NULL), m_lookahead(0.0f), m_track_slack(0.0f), m_best(0) {
+				const int controls = 3 * 5;
+				int count = controls * controls;
+				m_commands.resize(count * LOCAL_HORIZON_STEPS);
+				for (int c = 0; c < count; ++c) {
+					for (int k = 0; k < LOCAL_HORIZON_STEPS; ++k) {
+						int control = k < LOCAL_SWITCH_STEP ? c / controls : c % controls;
+						VehicleCommand& command = m_commands[c * LOCAL_HORIZON_STEPS + k];
+						command.move = static_cast<MoveState>(control / 5 + BREAKING);
+						command.turn = static_cast<TurnState>(control % 5 + HARD_LEFT);
+					}
+				}
+				m_xs.resize(count * LOCAL_HORIZON_STEPS);
+				m_ys.resize(count * LOCAL_HORIZON_STEPS);
+				m_cost.resize(count);
+				m_clearance.resize(count);
+				m_result.found = false;
+				m_result.candidates = count;
+				m_result.cost = m_result.clearance = 0.0f;
+				m_result.usec = 0;
+			}
+
+			int candidates() const {
+				return static_cast<int>(m_cost.size());
+			}
+			int threads() const {
+				return m_pool.threads() + 1;
+			}
+			const Result& result() const {
+				return m_result;
+			}
+			// Positions of the best candidate, one per command period.
+			const float *bestX() const {
+				return &m_xs[m_best * LOCAL_HORIZON_STEPS];
+			}
+			const float *bestY() const {
+				return &m_ys[m_best * LOCAL_HORIZON_STEPS];
+			}
+
+			//
+			// Picks the command to send now. Martian predictions, if any, must
+			// be sampled every `dt` seconds from the start state's time.
+			//
+			const Result& plan(const VehicleModel& model, const VehicleState& start, float dt,
+				WorldModel& world, const OccupancyGrid& grid, const MartianTracker& martians, const std::vector<Vector2>& path)
+			{
+				struct timespec started, finished;
+				clock_gettime(CLOCK_MONOTONIC, &started);
+				m_model = model;
+				m_start = start;
+				m_dt = dt;
+				m_martians = &martians;
+				m_grid = &grid;
+				gatherObstacles(world, Vector2(start.x, start.y), model.params().max_speed * dt * LOCAL_HORIZON_STEPS);
+				// Aim as far ahead as the rover gets over the horizon at its speed,
+				// so a slow rover follows the path closely instead of cutting corners.
+				float reach = std::max(start.speed, model.params().max_speed * LOCAL_MIN_LOOKAHEAD) * dt * LOCAL_HORIZON_STEPS;
+				m_lookahead = std::max(reach, grid.resolution() * 2.0f);
+				m_track_slack = grid.resolution();
+				m_path.assign(1, Vector2(start.x, start.y));
+				if (path.size() >= 2)
+					m_path.insert(m_path.end(), path.begin() + 1, path.end());
+				else
+					m_path.push_back(Vector2::ZERO);
+				m_length.resize(m_path.size());
+				m_length[0] = 0.0f;
+				for (std::size_t i = 1; i < m_path.size(); ++i)
+					m_length[i] = m_length[i - 1] + (m_path[i] - m_path[i - 1]).length();
+
+				m_pool.run(evaluateBatch, this, candidates(), LOCAL_CHUNK);
+
+				m_best = 0;
+				for (int c = 1; c < candidates(); ++c)
+					if (m_cost[c] < m_cost[m_best])
+						m_best = c;
+				m_result.found = m_cost[m_best] < COLLISION_COST;
+				m_result.command = m_commands[m_best * LOCAL_HORIZON_STEPS];
+				m_result.cost = m_cost[m_best];
+				m_result.clearance = m_clearance[m_best];
+				clock_gettime(CLOCK_MONOTONIC, &finished);
+				m_result.usec = (finished.tv_sec - started.tv_sec) * 1000000 + (finished.tv_nsec - started.tv_nsec) / 1000;
+				return m_result;
+			}
+
+		private:
+			static void evaluateBatch(void *context, int begin, int end) {
+				LocalPlanner *planner = static_cast<LocalPlanner *>(context);
+				for (int c = begin; c < end; ++c)
+					planner->evaluate(c);
+			}
+
+			void evaluate(int c) {
+				float *xs = &m_xs[c * LOCAL_HORIZON_STEPS];
+				float *ys = &m_ys[c * LOCAL_HORIZON_STEPS];
+				VehicleState end = m_model.rollout(m_start, &m_commands[c * LOCAL_HORIZON_STEPS], LOCAL_HORIZON_STEPS, m_dt, 2, xs, ys);
+
+				// Sooner collisions cost more. The first step only collides with
+				// an obstacle it gets closer to: the start may already touch one.
+				float cost = 0.0f;
+				CircleSet near(m_near_x, m_near_y, m_near_r);
+				float nearest = CLEARANCE_WANTED;
+				for (int k = 1; k <= LOCAL_HORIZON_STEPS; ++k) {
+					float ax = xs[k - 1], ay = ys[k - 1];
+					float x = k < LOCAL_HORIZON_STEPS ? xs[k] : end.x;
+					float y = k < LOCAL_HORIZON_STEPS ? ys[k] : end.y;
+					if (near.size > 0 && collides(near, ax, ay, x, y, k == 1)) {
+						cost += COLLISION_COST * (LOCAL_HORIZON_STEPS - k + 1);
+						break;
+					}
+					nearest = std::min(nearest, m_grid->clearance(m_grid->cellX(x), m_grid->cellY(y)));
+				}
+				cost += CLEARANCE_COST * (CLEARANCE_WANTED - nearest);
+
+				float clearance = std::numeric_limits<float>::max();
+				if (m_martians->size() > 0 && m_martians->steps() > 0) {
+					clearance = m_martians->clearance(xs, ys, LOCAL_HORIZON_STEPS, VEHICLE_RADIUS);
+					if (clearance < SAFETY_MARGIN)
+						cost += MARTIAN_COST * (SAFETY_MARGIN - clearance);
+				}
+
+				// Progress, in seconds at top speed left along the path, and how far off it.
+				float along, across;
+				project(end.x, end.y, along, across);
+				// Grid paths run through cell centers: a vehicle within a cell of one is on it.
+				cost += (m_length.back() - along) / m_model.params().max_speed + CROSS_TRACK_COST * std::max(0.0f, across - m_track_slack);
+				Vector2 ahead = pointAt(along + m_lookahead);
+				float bearing = std::atan2(ahead.y - end.y, ahead.x - end.x) * 180.0f / static_cast<float>(M_PI);
+				cost += HEADING_COST * std::fabs(std::fmod(bearing - end.dir + 540.0f, 360.0f) - 180.0f) / 180.0f;
+
+				m_cost[c] = cost;
+				m_clearance[c] = clearance;
+			}
+
+			// Copies the obstacles a rollout may reach from `at` within `reach` meters.
+			void gatherObstacles(WorldModel& world, const Vector2& at, float reach) {
+				world.queryRadius(at, reach + VEHICLE_RADIUS + SAFETY_MARGIN + LOCAL_OBSTACLE_SLACK, m_found);
+				m_near_x.clear();
+				m_near_y.clear();
+				m_near_r.clear();
+				for (std::size_t n = 0; n < m_found.size(); ++n) {
+					int i = m_found[n];
+					m_near_x.push_back(world.x[i]);
+					m_near_y.push_back(world.y[i]);
+					m_near_r.push_back(world.radius[i]);
+				}
+			}
+
+			// Whether the vehicle runs into an obstacle from (ax, ay) to (bx, by).
+			static bool collides(const CircleSet& near, float ax, float ay, float bx, float by, bool first) {
+				for (std::size_t i = firstSegmentHit(near, ax, ay, bx, by, VEHICLE_RADIUS); i < near.size;
+					i = firstSegmentHit(near, ax, ay, bx, by, VEHICLE_RADIUS, i + 1))
+				{
+					if (!first)
+						return true;
+					float dax = ax - near.x[i], day = ay - near.y[i];
+					float dbx = bx - near.x[i], dby = by - near.y[i];
+					if (dbx * dbx + dby * dby < dax * dax + day * day)
+						return true;
+				}
+				return false;
+			}
+
+			// Point `along` meters down the path, or its end.
+			Vector2 pointAt(float along) const {
+				for (std::size_t i = 1; i < m_path.size(); ++i) {
+					if (along <= m_length[i]) {
+						float leg = m_length[i] - m_length[i - 1];
+						float t = leg > 0.0f ? (along - m_length[i - 1]) / leg : 1.0f;
+						return m_path[i - 1] + (m_path[i] - m_path[i - 1]) * t;
+					}
+				}
+				return m_path.back();
+			}
+
+			// Distance along the path to the point of the path nearest to (x, y), and to that point.
+			void project(float x, float y, float& along, float& across) const {
+				along = 0.0f;
+				across = std::numeric_limits<float>::max();
+				for (std::size_t i = 1; i < m_path.size(); ++i) {
+					float ax = m_path[i - 1].x, ay = m_path[i - 1].y;
+					float sx = m_path[i].x - ax, sy = m_path[i].y - ay;
+					float length_sq = sx * sx + sy * sy;
+					float t = length_sq > 0.0f ? ((x - ax) * sx + (y - ay) * sy) / length_sq : 0.0f;
+					t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+					float dx = ax + t * sx - x, dy = ay + t * sy - y;
+					float distance = std::sqrt(dx * dx + dy * dy);
+					if (distance < across) {
+						across = distance;
+						along = m_length[i - 1] + t * (m_length[i] - m_length[i - 1]);
+					}
+				}
+			}
+
+			WorkerPool m_pool;
+			std::vector<VehicleCommand> m_commands; // m_commands[c * LOCAL_HORIZON_STEPS + k]
+			std::vector<float> m_xs; // rollout positions, laid out like m_commands
+			std::vector<float> m_ys;
+			std::vector<float> m_cost;
+			std::vector<float> m_clearance;
+			VehicleModel m_model;
+			VehicleState m_start;
+			float m_dt;
+			const MartianTracker *m_martians;
+			const OccupancyGrid *m_grid; // for the clearance cost, as of the last plan()
+			std::vector<float> m_near_x; // obstacles within reach of the horizon
+			std::vector<float> m_near_y;
+			std::vector<float> m_near_r;
+			std::vector<int> m_found;
+			float m_lookahead; // meters down the path the rover should be heading to
+			float m_track_slack; // meters off the path that are not charged for
+			std::vector<Vector2> m_path; // global path from the start state
+			std::vector<float> m_length; // along m_path up to each waypoint
+			int m_best;
+			Result m_result;
+	};
+
+}
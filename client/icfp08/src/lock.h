@@ -3,6 +3,7 @@
 #include <pthread.h>
 
 class Lock {
+	friend class Condition;
 	public:
 		Lock() {
 			pthread_mutex_init(&_lock, NULL);
@@ -20,6 +21,28 @@ class Lock {
 		pthread_mutex_t _lock;
 };
 
+class Condition {
+	public:
+		Condition() {
+			pthread_cond_init(&_cond, NULL);
+		}
+		~Condition() {
+			pthread_cond_destroy(&_cond);
+		}
+		// The caller must hold the lock.
+		void wait(Lock *lock) {
+			pthread_cond_wait(&_cond, &lock->_lock);
+		}
+		void signal() {
+			pthread_cond_signal(&_cond);
+		}
+		void broadcast() {
+			pthread_cond_broadcast(&_cond);
+		}
+	protected:
+		pthread_cond_t _cond;
+};
+
 class ScopeLock {
 	public:
 		ScopeLock(Lock *lock) : _lock(lock), _external(true) {
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <ostream>
+#include <streambuf>
+#include <stdint.h>
+#include <pthread.h>
+
+#define LOG_LEVEL_TRACE	0	// every message, raw and parsed
+#define LOG_LEVEL_DEBUG	1	// every planner tick and command
+#define LOG_LEVEL_INFO	2
+#define LOG_LEVEL_WARN	3
+#define LOG_LEVEL_ERROR	4
+
+// Lines below this level are compiled out; build with -DLOG_LEVEL=LOG_LEVEL_TRACE to see the messages.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// Lines held until the drain thread writes them out; more are dropped and counted.
+const std::size_t LOG_CAPACITY = 4096;
+// Longer lines are truncated.
+const std::size_t LOG_LINE_SIZE = 480;
+// How often the drain thread wakes up (milliseconds).
+const long LOG_DRAIN_MS = 20;
+
+struct LogEntry {
+	int64_t nsec; // monotonic clock
+	int level;
+	std::size_t length;
+	char text[LOG_LINE_SIZE];
+};
+
+//
+// Leveled log lines, formatted by the thread logging them into a slot of a
+// lock-free ring, and written out in batches by a thread of its own.
+//
+// Any thread may log: a slot is claimed with a compare-and-swap on the tail
+// and published through its sequence number, so logging never blocks on the
+// output, never flushes, and drops the line if the drain thread fell behind.
+// Until start(), only warnings and errors get through, straight to stderr.
+//
+class Logger {
+	public:
+		static Logger& instance() {
+			static Logger logger;
+			return logger;
+		}
+
+		// Writes the lines of `level` and above to `out` from now on.
+		bool start(FILE *out, int level = LOG_LEVEL) {
+			if (m_running)
+				return true;
+			m_out = out;
+			m_level = level;
+			m_stopping = false;
+			clock_gettime(CLOCK_MONOTONIC, &m_started);
+			if (pthread_create(&m_thread, NULL, threadFunc, this) != 0)
+				return false;
+			__atomic_store_n(&m_running, true, __ATOMIC_RELEASE);
+			return true;
+		}
+		bool start(const char *path, int level = LOG_LEVEL) {
+			FILE *out = fopen(path, "w");
+			if (out == NULL) {
+				perror(path);
+				return false;
+			}
+			m_owned = out;
+			return start(out, level);
+		}
+		// Writes out what is left, once every thread is done logging.
+		void stop() {
+			if (!m_running)
+				return;
+			__atomic_store_n(&m_running, false, __ATOMIC_RELEASE);
+			__atomic_store_n(&m_stopping, true, __ATOMIC_RELEASE);
+			pthread_join(m_thread, NULL);
+			if (m_owned != NULL) {
+				fclose(m_owned);
+				m_owned = NULL;
+			}
+		}
+
+		bool accepts(int level) const {
+			return __atomic_load_n(&m_running, __ATOMIC_ACQUIRE) ? level >= m_level : level >= LOG_LEVEL_WARN;
+		}
+
+		void write(int level, const char *text, std::size_t length) {
+			if (!__atomic_load_n(&m_running, __ATOMIC_ACQUIRE)) {
+				fprintf(stderr, "%.*s\n", static_cast<int>(length), text);
+				return;
+			}
+			std::size_t tail = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+			Slot *slot;
+			for (;;) {
+				slot = &m_slots[tail & (LOG_CAPACITY - 1)];
+				std::size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+				long diff = static_cast<long>(sequence) - static_cast<long>(tail);
+				if (diff == 0) {
+					if (__atomic_compare_exchange_n(&m_tail, &tail, tail + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+						break;
+				} else if (diff < 0) {
+					__sync_fetch_and_add(&m_dropped, 1);
+					return;
+				} else {
+					tail = __atomic_load_n(&m_tail, __ATOMIC_RELAXED);
+				}
+			}
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			slot->entry.nsec = static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+			slot->entry.level = level;
+			slot->entry.length = length < LOG_LINE_SIZE ? length : LOG_LINE_SIZE;
+			memcpy(slot->entry.text, text, slot->entry.length);
+			__atomic_store_n(&slot->sequence, tail + 1, __ATOMIC_RELEASE);
+		}
+
+		unsigned long written() const {
+			return m_written;
+		}
+		unsigned long dropped() const {
+			return m_dropped;
+		}
+
+	private:
+		struct Slot {
+			std::size_t sequence; // the tail it is free for, plus one once written
+			LogEntry entry;
+		};
+
+		Logger() : m_out(NULL), m_owned(NULL), m_level(LOG_LEVEL), m_running(false), m_stopping(false), m_head(0), m_tail(0), m_written(0), m_dropped(0) {
+			for (std::size_t i = 0; i < LOG_CAPACITY; ++i)
+				m_slots[i].sequence = i;
+		}
+		~Logger() {
+			stop();
+		}
+
+		static void *threadFunc(void *param) {
+			static_cast<Logger *>(param)->drain();
+			return NULL;
+		}
+
+		void drain() {
+			struct timespec pause = { 0, LOG_DRAIN_MS * 1000000 };
+			for (;;) {
+				bool stopping = __atomic_load_n(&m_stopping, __ATOMIC_ACQUIRE);
+				if (writeOut() > 0)
+					fflush(m_out);
+				if (stopping)
+					break;
+				nanosleep(&pause, NULL);
+			}
+		}
+
+		// Writes out the lines published so far.
+		std::size_t writeOut() {
+			static const char levels[] = { 'T', 'D', 'I', 'W', 'E' };
+			std::size_t count = 0;
+			for (;;) {
+				Slot& slot = m_slots[m_head & (LOG_CAPACITY - 1)];
+				if (__atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) != m_head + 1)
+					break;
+				const LogEntry& entry = slot.entry;
+				double seconds = (entry.nsec - (static_cast<int64_t>(m_started.tv_sec) * 1000000000 + m_started.tv_nsec)) * 1e-9;
+				fprintf(m_out, "%10.6f %c %.*s\n", seconds, levels[entry.level], static_cast<int>(entry.length), entry.text);
+				__atomic_store_n(&slot.sequence, m_head + LOG_CAPACITY, __ATOMIC_RELEASE);
+				++m_head;
+				++count;
+			}
+			m_written += count;
+			return count;
+		}
+
+		FILE *m_out;
+		FILE *m_owned; // opened by start(path)
+		int m_level;
+		bool m_running;
+		bool m_stopping;
+		struct timespec m_started;
+		pthread_t m_thread;
+		Slot m_slots[LOG_CAPACITY]; // LOG_CAPACITY is a power of two
+		char m_pad0[64];
+		std::size_t m_head; // drain thread's
+		char m_pad1[64];
+		std::size_t m_tail; // claimed by the loggers
+		char m_pad2[64];
+		unsigned long m_written; // drain thread's
+		unsigned long m_dropped;
+};
+
+//
+// One line being formatted, on the stack of the thread logging it, with the
+// usual operator<< overloads; it goes to the Logger once complete.
+//
+class LogLine : private std::streambuf {
+	public:
+		LogLine(int level) : m_stream(this), m_level(level) {
+			setp(m_text, m_text + LOG_LINE_SIZE);
+		}
+		~LogLine() {
+			Logger::instance().write(m_level, m_text, pptr() - m_text);
+		}
+
+		std::ostream& stream() {
+			return m_stream;
+		}
+
+	private:
+		// Full: the rest of the line is left out.
+		int overflow(int) {
+			return traits_type::eof();
+		}
+
+		std::ostream m_stream;
+		int m_level;
+		char m_text[LOG_LINE_SIZE];
+};
+
+#define LOG_AT(level, expr) \
+	do { \
+		if (Logger::instance().accepts(level)) \
+			LogLine(level).stream() << expr; \
+	} while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(expr) LOG_AT(LOG_LEVEL_TRACE, expr)
+#else
+#define LOG_TRACE(expr) do { } while (0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(expr) LOG_AT(LOG_LEVEL_DEBUG, expr)
+#else
+#define LOG_DEBUG(expr) do { } while (0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(expr) LOG_AT(LOG_LEVEL_INFO, expr)
+#else
+#define LOG_INFO(expr) do { } while (0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(expr) LOG_AT(LOG_LEVEL_WARN, expr)
+#else
+#define LOG_WARN(expr) do { } while (0)
+#endif
+#define LOG_ERROR(expr) LOG_AT(LOG_LEVEL_ERROR, expr)
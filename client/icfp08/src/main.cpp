@@ -2,43 +2,198 @@
 #include <cstdio>
 #include <cerrno>
 #include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
 #include "socket.h"
 #include "protocol.h"
 #include "movement.h"
 #include "pathfind.h"
+#include "eventloop.h"
+#include "recorder.h"
+#include "log.h"
+#include "timing.h"
 
-int main(int argc, char **argv) {
-	if (argc != 3) {
-		std::cerr << "usage: <hostname> <port>" << std::endl;
-		fprintf(stderr, "usage: <hostname> <port>\n");
-		exit(1);
+using namespace Communication;
+using namespace Movement;
+
+struct Session {
+	EventLoop *loop;
+	ProtocolStream *stream;
+	ProtocolParser *parser;
+	Controller *controller;
+	Protocol::Message message;
+	FILE *timings_csv; // NULL for none
+	int run;
+};
+
+static EventLoop *signal_loop;
+static volatile sig_atomic_t dump_requested;
+
+// SIGUSR1: the I/O thread dumps the timings when woken up.
+static void onSignal(int) {
+	dump_requested = 1;
+	signal_loop->wake();
+}
+
+// Logs the histograms of the current run, and appends them to the CSV file if any.
+static void dumpTimings(Session *session) {
+	Timings& timings = Timings::instance();
+	LOG_INFO("run " << session->run << " timings: " << Timings::header());
+	char line[160];
+	for (int i = 0; i < Timings::STAGES; ++i) {
+		Timings::Stage stage = static_cast<Timings::Stage>(i);
+		if (timings.histogram(stage).count() > 0)
+			LOG_INFO("run " << session->run << " timings: " << timings.format(stage, line, sizeof(line)));
+	}
+	if (session->timings_csv != NULL)
+		timings.writeCsv(session->timings_csv, session->run);
+}
+
+// The socket is readable: parse and apply every complete message right away.
+static void onReadable(void *context) {
+	Session *session = static_cast<Session *>(context);
+	Timings& timings = Timings::instance();
+	int64_t started = Timings::now();
+	bool open = session->stream->receive();
+	int64_t finished = Timings::now();
+	timings.record(Timings::RECEIVE, finished - started);
+	Slice command;
+	for (started = finished; session->stream->get(command); started = finished) {
+		int64_t framed = Timings::now();
+		timings.record(Timings::FRAME, framed - started);
+		bool valid = session->parser->parse(session->message, command);
+		int64_t parsed = Timings::now();
+		timings.record(Timings::PARSE, parsed - framed);
+		finished = parsed;
+		if (!valid) {
+			// Never apply the fields a malformed message left unread.
+			session->message.clear();
+			continue;
+		}
+		if (session->message.tag == Protocol::TAG_TELEMETRY_STREAM)
+			timings.telemetryReceived(session->message.telemetry.timestamp);
+		session->controller->state().update(session->message);
+		finished = Timings::now();
+		timings.record(Timings::UPDATE, finished - parsed);
+		if (session->message.tag == Protocol::TAG_END_OF_RUN) {
+			dumpTimings(session);
+			timings.reset();
+			++session->run;
+		}
+		session->message.clear();
+	}
+	if (!open)
+		session->loop->stop();
+}
+
+// Commands were queued, or the timings asked for: send and dump them now.
+static void onCommands(void *context) {
+	Session *session = static_cast<Session *>(context);
+	session->stream->flush();
+	if (dump_requested) {
+		dump_requested = 0;
+		dumpTimings(session);
 	}
+}
+
+// The socket takes writes again: send what it did not take before.
+static void onWritable(void *context) {
+	Session *session = static_cast<Session *>(context);
+	session->stream->flush();
+}
 
-	using namespace Communication;
-	using namespace Movement;
+static void usage() {
+	fprintf(stderr, "usage: [-l <trace>] [-c <timings.csv>] [-w <world file>] <hostname> <port> [<log>]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	const char *trace = NULL;
+	const char *timings_csv = NULL;
+	const char *world_file = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "l:c:w:")) != -1) {
+		switch (opt) {
+			case 'l': trace = optarg; break;
+			case 'c': timings_csv = optarg; break;
+			case 'w': world_file = optarg; break;
+			default: usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 2 && argc != 3)
+		usage();
 
-	Socket sock(argv[1], atoi(argv[2]));
+	// The tracing goes to stdout unless given a file, written from a thread of its own.
+	Logger& logger = Logger::instance();
+	if (trace != NULL ? !logger.start(trace) : !logger.start(stdout))
+		return 1;
+	Recorder recorder; // outlives both threads, which record into it
+	if (argc == 3 && !recorder.open(argv[2]))
+		return 1;
+	WorldStore world_store; // the obstacles of the maps played before, by this process or others
+	if (world_file != NULL && !world_store.open(world_file))
+		return 1;
+	EventLoop loop; // outlives the planner thread, which wakes it
+	Socket sock(argv[0], atoi(argv[1]));
 	ProtocolStream proto_stream(sock);
 	ProtocolParser proto_parser;
 	Controller controller(&proto_stream);
 	PathFind path_finder(&controller);
+	if (recorder.isOpen()) {
+		proto_stream.setRecorder(&recorder);
+		path_finder.setRecorder(&recorder);
+	}
+	if (world_store.isOpen())
+		controller.state().setWorldStore(&world_store);
 
 	if (!sock.connect())
 		return 0;
 	std::cout << "connected to " << sock.hostname() << ":" << sock.port() << std::endl;
 	sock.setBlocking(false);
 
-	Protocol::Message message;
-	std::string command;
-
-	while (true) {
-		proto_stream.poll();
-		while (proto_stream.get(command)) {
-			proto_parser.parse(message, command);
-			controller.state().update(message);
-			message.clear();
-			sleep(0); // yield
-		}
+	Session session;
+	session.loop = &loop;
+	session.stream = &proto_stream;
+	session.parser = &proto_parser;
+	session.controller = &controller;
+	session.timings_csv = NULL;
+	session.run = 0;
+	if (timings_csv != NULL && (session.timings_csv = fopen(timings_csv, "w")) == NULL) {
+		perror(timings_csv);
+		return 1;
+	}
+	signal_loop = &loop;
+	signal(SIGUSR1, onSignal);
+	proto_stream.attach(&loop);
+	loop.onWake(onCommands, &session);
+	if (!loop.watch(sock.fd(), onReadable, &session, onWritable))
+		return 1;
+	loop.run();
+	path_finder.stop();
+	controller.state().saveWorld();
+	// What came after the last end of run.
+	if (Timings::instance().histogram(Timings::RECEIVE).count() > 1)
+		dumpTimings(&session);
+	logger.stop();
+	if (session.timings_csv != NULL)
+		fclose(session.timings_csv);
+
+	const SpscQueue<WorldEvent>& events = controller.state().worldEvents();
+	const SpscQueue<OutgoingCommand>& commands = proto_stream.outgoing();
+	std::cout << "world events: " << events.pushed() << " queued, high-water " << events.highWater()
+		<< "/" << events.capacity() << ", " << events.drops() << " dropped" << std::endl;
+	std::cout << "commands: " << commands.pushed() << " queued, high-water " << commands.highWater()
+		<< "/" << commands.capacity() << ", " << commands.drops() << " dropped" << std::endl;
+	std::cout << "writer: " << proto_stream.writerStats() << std::endl;
+	if (world_store.isOpen())
+		std::cout << "world store: " << world_store.snapshots() << " maps, " << world_store.loaded() << " obstacles loaded" << std::endl;
+	std::cout << "trace: " << logger.written() << " lines, " << logger.dropped() << " dropped" << std::endl;
+	if (recorder.isOpen()) {
+		std::cout << "log: " << recorder.size() << " bytes, " << recorder.dropped() << " records dropped" << std::endl;
+		recorder.close();
 	}
 	sock.disconnect();
 	std::cout << std::endl << "done" << std::endl;
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include "protocol.h"
+#include "vector2.h"
+#include "geometry.h"
+
+namespace Movement {
+
+	using namespace Communication;
+
+	const float MARTIAN_RADIUS = 0.4f; // meters
+	const int MARTIAN_TRACK_TIMEOUT = 2000; // milliseconds a track survives unseen
+	const float MARTIAN_GATE = 3.0f; // meters an observation may be off its prediction
+
+	//
+	// Tracks the Martians across telemetry messages and predicts where they go.
+	//
+	// Observations are associated to tracks by nearest neighbour against each
+	// track's prediction, and every track follows a constant speed, constant
+	// turn rate model whose turn rate is estimated from consecutive headings.
+	//
+	// predict() fills a table of future positions (one row per time step, one
+	// column per Martian) that the collision queries scan with plain loops, so
+	// many candidate trajectories can be checked per tick.
+	//
+	class MartianTracker {
+		public:
+			// Tracks, one entry per Martian, as parallel arrays.
+			std::vector<float> x;
+			std::vector<float> y;
+			std::vector<float> dir; // degrees
+			std::vector<float> speed; // meters per second
+			std::vector<float> turn_rate; // degrees per second
+			std::vector<int> last_seen; // milliseconds
+
+			MartianTracker() : m_steps(0), m_step(0.1f), m_growth(0.5f) {
+				// nop
+			}
+
+			std::size_t size() const {
+				return x.size();
+			}
+			void clear() {
+				x.clear();
+				y.clear();
+				dir.clear();
+				speed.clear();
+				turn_rate.clear();
+				last_seen.clear();
+				m_steps = 0;
+			}
+
+			//
+			// Associates the Martians of a telemetry message with the tracks.
+			//
+			void update(int timestamp, const Protocol::MartianArray& seen) {
+				m_taken.assign(seen.size(), 0);
+				// Match every track to its nearest unclaimed observation.
+				for (std::size_t t = 0; t < size(); ++t) {
+					float dt = (timestamp - last_seen[t]) * 0.001f;
+					float px, py;
+					extrapolate(t, dt, px, py);
+					float gate = MARTIAN_GATE + speed[t] * dt;
+					int best = -1;
+					float best_d2 = gate * gate;
+					for (std::size_t o = 0; o < seen.size(); ++o) {
+						float dx = seen.x[o] - px, dy = seen.y[o] - py;
+						float d2 = dx * dx + dy * dy;
+						if (!m_taken[o] && d2 < best_d2) {
+							best_d2 = d2;
+							best = static_cast<int>(o);
+						}
+					}
+					if (best == -1)
+						continue;
+					m_taken[best] = 1;
+					if (dt > 0.0f) {
+						float turned = std::fmod(seen.dir[best] - dir[t] + 540.0f, 360.0f) - 180.0f;
+						// Smooth the estimate, the reported heading is noisy.
+						turn_rate[t] = 0.5f * turn_rate[t] + 0.5f * turned / dt;
+					}
+					x[t] = seen.x[best];
+					y[t] = seen.y[best];
+					dir[t] = seen.dir[best];
+					speed[t] = seen.speed[best];
+					last_seen[t] = timestamp;
+				}
+				// Unclaimed observations start new tracks.
+				for (std::size_t o = 0; o < seen.size(); ++o) {
+					if (m_taken[o])
+						continue;
+					x.push_back(seen.x[o]);
+					y.push_back(seen.y[o]);
+					dir.push_back(seen.dir[o]);
+					speed.push_back(seen.speed[o]);
+					turn_rate.push_back(0.0f);
+					last_seen.push_back(timestamp);
+				}
+				// Martians out of sight for too long are forgotten.
+				for (std::size_t t = 0; t < size(); ) {
+					if (timestamp - last_seen[t] > MARTIAN_TRACK_TIMEOUT)
+						remove(t);
+					else
+						++t;
+				}
+			}
+
+			//
+			// Fills the prediction table for `steps` time steps of `step` seconds
+			// starting at `timestamp`. `growth` widens each Martian by that many
+			// meters per second of prediction, to account for its uncertainty.
+			//
+			void predict(int timestamp, int steps, float step, float growth) {
+				m_steps = steps;
+				m_step = step;
+				m_growth = growth;
+				std::size_t n = size();
+				m_px.resize(steps * n);
+				m_py.resize(steps * n);
+				for (std::size_t t = 0; t < n; ++t) {
+					float dt0 = (timestamp - last_seen[t]) * 0.001f;
+					for (int k = 0; k < steps; ++k)
+						extrapolate(t, dt0 + k * step, m_px[k * n + t], m_py[k * n + t]);
+				}
+			}
+			int steps() const {
+				return m_steps;
+			}
+			float step() const {
+				return m_step;
+			}
+
+			//
+			// Smallest distance between the rover (radius `radius`) and any predicted
+			// Martian along a trajectory sampled at the prediction time steps (xs[k],
+			// ys[k] at k * step()). Negative means a collision. Samples past the
+			// prediction horizon are ignored.
+			//
+			float clearance(const float *xs, const float *ys, int samples, float radius) const {
+				std::size_t n = size();
+				float best = std::numeric_limits<float>::max();
+				if (samples > m_steps)
+					samples = m_steps;
+				for (int k = 0; k < samples; ++k) {
+					float nearest = nearestSq(&m_px[k * n], &m_py[k * n], n, xs[k], ys[k]);
+					float reach = radius + MARTIAN_RADIUS + m_growth * k * m_step;
+					float gap = std::sqrt(nearest) - reach;
+					best = gap < best ? gap : best;
+				}
+				return best;
+			}
+
+			//
+			// Clearance of `count` trajectories at once. Trajectory c is sampled at
+			// xs[c * samples + k], ys[c * samples + k].
+			//
+			void clearances(const float *xs, const float *ys, int samples, int count, float radius, float *out) const {
+				for (int c = 0; c < count; ++c)
+					out[c] = clearance(xs + c * samples, ys + c * samples, samples, radius);
+			}
+
+			// Whether the trajectory gets closer than `margin` to a Martian.
+			bool collides(const float *xs, const float *ys, int samples, float radius, float margin = 0.0f) const {
+				return clearance(xs, ys, samples, radius) < margin;
+			}
+
+		private:
+			// Constant speed, constant turn rate motion of track t over dt seconds.
+			void extrapolate(std::size_t t, float dt, float& px, float& py) const {
+				float heading = dir[t] * static_cast<float>(M_PI) / 180.0f;
+				float omega = turn_rate[t] * static_cast<float>(M_PI) / 180.0f;
+				if (std::fabs(omega) < 1e-3f) {
+					px = x[t] + speed[t] * dt * std::cos(heading);
+					py = y[t] + speed[t] * dt * std::sin(heading);
+				} else {
+					float r = speed[t] / omega;
+					px = x[t] + r * (std::sin(heading + omega * dt) - std::sin(heading));
+					py = y[t] + r * (std::cos(heading) - std::cos(heading + omega * dt));
+				}
+			}
+			void remove(std::size_t t) {
+				std::size_t last = size() - 1;
+				x[t] = x[last];
+				y[t] = y[last];
+				dir[t] = dir[last];
+				speed[t] = speed[last];
+				turn_rate[t] = turn_rate[last];
+				last_seen[t] = last_seen[last];
+				x.pop_back();
+				y.pop_back();
+				dir.pop_back();
+				speed.pop_back();
+				turn_rate.pop_back();
+				last_seen.pop_back();
+			}
+
+			int m_steps;
+			float m_step;
+			float m_growth;
+			std::vector<float> m_px; // m_px[k * size() + t], position of track t at step k
+			std::vector<float> m_py;
+			std::vector<char> m_taken;
+	};
+
+}
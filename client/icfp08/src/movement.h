@@ -1,71 +1,358 @@
 #pragma once
 
 #include <string>
+#include <ctime>
+#include <climits>
 #include "protocol.h"
 #include "lock.h"
 #include "vector2.h"
-
-#define DECLARE_ENUM_OPERATORS(_TYPE) \
-	inline _TYPE& \
-	operator++(_TYPE& v1) \
-	{ v1 = _TYPE(static_cast<int>(v1) + 1); return v1; } \
-	\
-	inline _TYPE& \
-	operator--(_TYPE& v1) \
-	{ v1 = _TYPE(static_cast<int>(v1) - 1); return v1; }
+#include "worldmodel.h"
+#include "worldstore.h"
+#include "martians.h"
+#include "dynamics.h"
+#include "triplebuffer.h"
+#include "spscqueue.h"
+#include "log.h"
 
 namespace Movement {
 
-	enum MoveState {
-		BREAKING		= -1,
-		ROLLING			= 0,
-		ACCELERATING	= 1
-	};
-	DECLARE_ENUM_OPERATORS(MoveState)
-
-	enum TurnState {
-		HARD_LEFT	= -2,
-		LEFT		= -1,
-		STRAIGHT	= 0,
-		RIGHT		= 1,
-		HARD_RIGHT	= 2
+	using namespace Communication;
+
+	const float VEHICLE_RADIUS = 0.5f; // meters
+	const float SAFETY_MARGIN = 0.5f; // meters kept between the vehicle and any obstacle
+	const float VEHICLE_PREDICTION_DT = 0.05f; // seconds per step when predicting the vehicle between telemetry
+
+	//
+	// What the I/O thread tells the planner about the world: one fixed-size
+	// record per obstacle or Martian seen, a FRAME closing each telemetry
+	// message, a RESET for each new trial and an END_OF_RUN after each run.
+	//
+	struct WorldEvent {
+		enum Kind {
+			RESET,
+			OBSTACLE,
+			MARTIAN,
+			FRAME,
+			END_OF_RUN // the map stays the same for the next run, the Martians do not
+		};
+		Kind kind;
+		Protocol::ObjectTag tag; // OBSTACLE
+		int timestamp; // FRAME
+		int sequence; // FRAME, telemetry messages received up to this one
+		float x; // OBSTACLE and MARTIAN; map width for RESET
+		float y; // OBSTACLE and MARTIAN; map height for RESET
+		float radius; // OBSTACLE
+		float dir; // MARTIAN
+		float speed; // MARTIAN
 	};
-	DECLARE_ENUM_OPERATORS(TurnState)
 
-	using namespace Communication;
+	// Records the planner may fall behind by. Obstacles dropped when it is
+	// full are not lost for good, they show up again in later telemetry.
+	const std::size_t WORLD_EVENT_CAPACITY = 4096;
+	// Of those, kept free of obstacles and Martians for RESET, FRAME and
+	// END_OF_RUN, which are not sent again: a frame is only lost once the
+	// planner is this many messages behind.
+	const std::size_t WORLD_EVENT_CONTROL_RESERVE = 512;
 
+	//
+	// What the controller knows about the vehicle and the run.
+	//
+	// The I/O thread update()s its own copy of the state on every message and
+	// publishes a snapshot of it through a triple buffer. The planner thread
+	// refresh()es `current` from the latest snapshot at the start of a tick
+	// and reads it without locking; the planner also owns `move`, `turn` and
+	// `expected`. Obstacles and Martians reach the planner as WorldEvents on a
+	// queue, which refresh() applies to the planner-owned world and tracker.
+	//
 	class ControllerState {
 		friend class Controller;
 		friend class PathFind;
 		public:
+			// I/O thread only.
 			void update(const Protocol::Message& message) {
-				ScopeLock lock(&current.lock);
+				Data& latest = m_latest;
 				switch (message.tag) {
 					case Protocol::TAG_INITIALIZATION:
-						current.map_size.x		= message.initialization.dx;
-						current.map_size.y		= message.initialization.dy;
-						current.time_limit		= message.initialization.time_limit;
-						current.sensor_range.x	= message.initialization.min_sensor;
-						current.sensor_range.y	= message.initialization.max_sensor;
-						current.max_speed		= message.initialization.max_speed;
-						current.max_turn		= message.initialization.max_turn;
-						current.max_hard_turn	= message.initialization.max_hard_turn;
+						latest.map_size.x		= message.initialization.dx;
+						latest.map_size.y		= message.initialization.dy;
+						latest.time_limit		= message.initialization.time_limit;
+						latest.sensor_range.x	= message.initialization.min_sensor;
+						latest.sensor_range.y	= message.initialization.max_sensor;
+						latest.max_speed		= message.initialization.max_speed;
+						latest.max_turn			= message.initialization.max_turn;
+						latest.max_hard_turn	= message.initialization.max_hard_turn;
+						m_model.initialize(latest.max_speed, latest.max_turn, latest.max_hard_turn);
+						latest.params = m_model.params();
+						{
+							WorldEvent event;
+							event.kind = WorldEvent::RESET;
+							event.x = message.initialization.dx;
+							event.y = message.initialization.dy;
+							pushControl(event);
+						}
+						publish();
 						break;
 					case Protocol::TAG_TELEMETRY_STREAM:
-						current.time_stamp		= message.telemetry.timestamp;
-						current.vehicle_ctl[0]	= message.telemetry.vehicle_ctl[0];
-						current.vehicle_ctl[1]	= message.telemetry.vehicle_ctl[1];
-						current.vehicle_pos.x	= message.telemetry.vehicle_x;
-						current.vehicle_pos.y	= message.telemetry.vehicle_y;
-						current.vehicle_dir		= message.telemetry.vehicle_dir;
-						current.vehicle_speed	= message.telemetry.vehicle_speed;
+						latest.time_stamp		= message.telemetry.timestamp;
+						latest.vehicle_ctl[0]	= message.telemetry.vehicle_ctl[0];
+						latest.vehicle_ctl[1]	= message.telemetry.vehicle_ctl[1];
+						latest.vehicle_pos.x	= message.telemetry.vehicle_x;
+						latest.vehicle_pos.y	= message.telemetry.vehicle_y;
+						latest.vehicle_dir		= message.telemetry.vehicle_dir;
+						latest.vehicle_speed	= message.telemetry.vehicle_speed;
+						{
+							VehicleState reported = reportedState(latest);
+							m_model.observe(latest.time_stamp, reported);
+							latest.turn_rate = reported.turn_rate;
+							latest.params = m_model.params();
+						}
+						clock_gettime(CLOCK_MONOTONIC, &latest.received);
+						if (message.telemetry.objects != NULL) {
+							int dropped = queueObjects(*message.telemetry.objects);
+							if (dropped > 0)
+								LOG_WARN(dropped << " objects of telemetry " << message.telemetry.timestamp << " dropped, world event queue full");
+						}
+						{
+							WorldEvent event;
+							event.kind = WorldEvent::FRAME;
+							event.timestamp = message.telemetry.timestamp;
+							event.sequence = latest.telemetry_count + 1;
+							pushControl(event);
+						}
+						++latest.telemetry_count;
+						publish();
+						{
+							ScopeLock lock(&m_signal);
+							m_telemetry_count = latest.telemetry_count;
+							m_telemetry.broadcast();
+						}
+						break;
+					case Protocol::TAG_END_OF_RUN: {
+						WorldEvent event;
+						event.kind = WorldEvent::END_OF_RUN;
+						pushControl(event);
+						break;
+					}
+					default:
 						break;
 				}
 			}
+
+			//
+			// Planner thread only: takes the latest snapshot as `current`, with
+			// the control state the server reported in it, if there is a new
+			// one, and applies the world events queued up to its telemetry, so
+			// the world is seen as of the same message. Also fixes how far the
+			// vehicle is predicted ahead of `current` for the rest of the tick.
+			//
+			void refresh() {
+				if (m_snapshots.update()) {
+					current = m_snapshots.front();
+					// The server is the authority on the control state.
+					move = VehicleModel::moveState(current.vehicle_ctl[0]);
+					turn = VehicleModel::turnState(current.vehicle_ctl[1]);
+				}
+				applyWorldEvents(current.telemetry_count);
+				m_elapsed = 0.0f;
+				if (m_replay_elapsed >= 0.0f) {
+					m_elapsed = m_replay_elapsed;
+					m_replay_elapsed = -1.0f;
+				} else if (m_real_time && current.received.tv_sec != 0) {
+					struct timespec now;
+					clock_gettime(CLOCK_MONOTONIC, &now);
+					m_elapsed = (now.tv_sec - current.received.tv_sec) + (now.tv_nsec - current.received.tv_nsec) * 1e-9f;
+					// Nothing for so long that extrapolating is pointless.
+					if (m_elapsed > 1.0f)
+						m_elapsed = 0.0f;
+				}
+			}
+			// Seconds since `current` arrived, as of the last refresh().
+			float elapsed() const {
+				return m_elapsed;
+			}
+			// Makes the next refresh() take `seconds` as the elapsed time, as a recorded tick did.
+			void replayElapsed(float seconds) {
+				m_replay_elapsed = seconds;
+			}
+
+			//
+			// Where the vehicle is expected to be `ahead` seconds from now, rolling
+			// `current` forward by the time elapsed since it arrived.
+			// The server time of the prediction goes to `timestamp`, if given.
+			//
+			VehicleState predict(float ahead = 0.0f, int *timestamp = NULL) const {
+				VehicleState s = reportedState(current);
+				s.move = move;
+				s.turn = turn;
+				VehicleModel model;
+				model.setParams(current.params);
+				model.advance(s, m_elapsed + ahead, VEHICLE_PREDICTION_DT);
+				if (timestamp != NULL)
+					*timestamp = current.time_stamp + static_cast<int>((m_elapsed + ahead) * 1000.0f);
+				return s;
+			}
+			//
+			// Blocks until telemetry newer than the `seen`-th message arrives and
+			// returns how many have arrived, or -1 once stop() was called.
+			//
+			int waitForTelemetry(int seen) {
+				ScopeLock lock(&m_signal);
+				while (m_telemetry_count == seen && !m_stopped)
+					m_telemetry.wait(&m_signal);
+				return m_stopped ? -1 : m_telemetry_count;
+			}
+			// Releases everyone waiting for telemetry, for good.
+			void stop() {
+				ScopeLock lock(&m_signal);
+				m_stopped = true;
+				m_telemetry.broadcast();
+			}
+			const VehicleParams& vehicleParams() const {
+				return current.params;
+			}
+			//
+			// Whether the server's clock runs while the planner thinks, so the
+			// vehicle is predicted ahead by the time since the last telemetry.
+			// Off when a simulator waits for every tick instead.
+			//
+			void setRealTime(bool real_time) {
+				m_real_time = real_time;
+			}
+			const SpscQueue<WorldEvent>& worldEvents() const {
+				return m_world_events;
+			}
+			//
+			// Loads the obstacles of a map played before from `store` as soon as
+			// the first ones seen identify it, and saves them there after each run.
+			// Before the first telemetry.
+			//
+			void setWorldStore(WorldStore *store) {
+				m_world_store = store;
+			}
+			//
+			// Applies the world events left and saves the world to the store, if
+			// any, once the planner is done: no telemetry follows the last end of
+			// run to have it applied.
+			//
+			void saveWorld() {
+				applyWorldEvents(INT_MAX);
+				if (m_world_store != NULL)
+					m_world_store->save(world);
+			}
 		protected:
-			ControllerState() : move(ROLLING), turn(STRAIGHT) {
+			struct Data {
+				Vector2 map_size; // map size (meters)
+				int time_limit; // max time to accomplish the run (milliseconds)
+				Vector2 sensor_range; // minimum and maximum sensor range (meters)
+				float max_speed; // (meters per second)
+				float max_turn; // (degrees per second)
+				float max_hard_turn; // (degrees per second)
+				int time_stamp; // timestamp (milliseconds)
+				char vehicle_ctl[2]; //...
+				Vector2 vehicle_pos; // current vehicle position
+				float vehicle_dir;  // current direction in (degrees)
+				float vehicle_speed; // current speed (meters per second)
+				float turn_rate; // current counterclockwise turn rate (degrees per second)
+				struct timespec received; // when the last telemetry arrived (monotonic clock)
+				VehicleParams params; // as estimated so far
+				int telemetry_count; // telemetry messages received
+
+				Data() : map_size(Vector2::ZERO), time_limit(0), sensor_range(Vector2::ZERO),
+					max_speed(0.0f), max_turn(0.0f), max_hard_turn(0.0f), time_stamp(0),
+					vehicle_pos(Vector2::ZERO), vehicle_dir(0.0f), vehicle_speed(0.0f), turn_rate(0.0f),
+					telemetry_count(0)
+				{
+					vehicle_ctl[0] = vehicle_ctl[1] = '-';
+					received.tv_sec = received.tv_nsec = 0;
+				}
+			};
+
+			ControllerState() : m_world_events(WORLD_EVENT_CAPACITY), m_telemetry_count(0), m_stopped(false), m_real_time(true), m_elapsed(0.0f), m_replay_elapsed(-1.0f), m_applied_sequence(0), m_world_store(NULL), move(ROLLING), turn(STRAIGHT) {
 				// nop
 			}
+			static VehicleState reportedState(const Data& data) {
+				VehicleState s;
+				s.x = data.vehicle_pos.x;
+				s.y = data.vehicle_pos.y;
+				s.dir = data.vehicle_dir;
+				s.speed = data.vehicle_speed;
+				s.turn_rate = data.turn_rate;
+				s.move = VehicleModel::moveState(data.vehicle_ctl[0]);
+				s.turn = VehicleModel::turnState(data.vehicle_ctl[1]);
+				return s;
+			}
+			void publish() {
+				m_snapshots.back() = m_latest;
+				m_snapshots.publish();
+			}
+			// Leaves WORLD_EVENT_CONTROL_RESERVE slots free; returns how many objects did not fit.
+			int queueObjects(const Protocol::ObjectStore& objects) {
+				int dropped = 0;
+				WorldEvent event;
+				event.kind = WorldEvent::OBSTACLE;
+				for (int k = 0; k < 2; ++k) {
+					const Protocol::CircleArray& circles = k == 0 ? objects.boulders : objects.craters;
+					event.tag = k == 0 ? Protocol::TAG_BOULDER : Protocol::TAG_CRATER;
+					for (std::size_t i = 0; i < circles.size(); ++i) {
+						event.x = circles.x[i];
+						event.y = circles.y[i];
+						event.radius = circles.radius[i];
+						if (!m_world_events.push(event, WORLD_EVENT_CONTROL_RESERVE))
+							++dropped;
+					}
+				}
+				event.kind = WorldEvent::MARTIAN;
+				for (std::size_t i = 0; i < objects.martians.size(); ++i) {
+					event.x = objects.martians.x[i];
+					event.y = objects.martians.y[i];
+					event.dir = objects.martians.dir[i];
+					event.speed = objects.martians.speed[i];
+					if (!m_world_events.push(event, WORLD_EVENT_CONTROL_RESERVE))
+						++dropped;
+				}
+				return dropped;
+			}
+			void pushControl(const WorldEvent& event) {
+				if (!m_world_events.push(event))
+					LOG_ERROR("world event " << event.kind << " dropped, the planner is " << WORLD_EVENT_CONTROL_RESERVE << " messages behind");
+			}
+			// Up to the FRAME of the `sequence`-th telemetry message; later ones stay queued.
+			void applyWorldEvents(int sequence) {
+				WorldEvent event;
+				while (m_applied_sequence < sequence && m_world_events.pop(event)) {
+					switch (event.kind) {
+						case WorldEvent::RESET:
+							world.reset(event.x, event.y);
+							if (m_world_store != NULL)
+								m_world_store->reset(world);
+							martians.clear();
+							m_frame_martians.clear();
+							break;
+						case WorldEvent::OBSTACLE:
+							world.insert(event.tag, event.x, event.y, event.radius);
+							break;
+						case WorldEvent::MARTIAN: {
+							Protocol::ObjectMartian martian = { event.x, event.y, event.dir, event.speed };
+							m_frame_martians.push(martian);
+							break;
+						}
+						case WorldEvent::FRAME:
+							martians.update(event.timestamp, m_frame_martians);
+							m_frame_martians.clear();
+							m_applied_sequence = event.sequence;
+							if (m_world_store != NULL)
+								m_world_store->frame(world);
+							break;
+						case WorldEvent::END_OF_RUN:
+							// The clock starts over with the next run.
+							martians.clear();
+							m_frame_martians.clear();
+							if (m_world_store != NULL)
+								m_world_store->save(world);
+							break;
+					}
+				}
+			}
 			bool turnRight() {
 				if (turn == HARD_RIGHT)
 					return false;
@@ -85,78 +372,150 @@ namespace Movement {
 				return true;
 			}
 			bool brake() {
-				if (move != BREAKING)
+				if (move == BREAKING)
 					return false;
 				--move;
 				return true;
 			}
 
-			struct Data {
-				Lock lock;
-				Vector2 map_size; // map size (meters)
-				int time_limit; // max time to accomplish the run (milliseconds)
-				Vector2 sensor_range; // minimum and maximum sensor range (meters)
-				float max_speed; // (meters per second)
-				float max_turn; // (degrees per second)
-				float max_hard_turn; // (degrees per second)
-				int time_stamp; // timestamp (milliseconds)
-				char vehicle_ctl[2]; //...
-				Vector2 vehicle_pos; // current vehicle position
-				float vehicle_dir;  // current direction in (degrees)
-				float vehicle_speed; // current speed (meters per second)
-			};
-
-			Data current;
+			Data current; // planner's view, as of the last refresh()
 			Data expected;
-			MoveState move;
-			TurnState turn;
+			WorldModel world; // obstacles seen so far, planner's
+			MartianTracker martians; // Martians seen lately, planner's
+		private:
+			Data m_latest; // I/O thread's copy
+			VehicleModel m_model; // I/O thread's, estimating the parameters
+			TripleBuffer<Data> m_snapshots;
+			SpscQueue<WorldEvent> m_world_events; // I/O thread to planner
+			Protocol::MartianArray m_frame_martians; // planner's, the frame being applied
+			Lock m_signal;
+			Condition m_telemetry; // signaled with m_signal held
+			int m_telemetry_count;
+			bool m_stopped;
+			bool m_real_time;
+			float m_elapsed; // planner's, see refresh()
+			float m_replay_elapsed; // for the next refresh(), if not negative
+			int m_applied_sequence; // planner's, last FRAME applied
+			WorldStore *m_world_store; // planner's, NULL for none
+		protected:
+			MoveState move; // planner's
+			TurnState turn; // planner's
 	};
 
+	const int TURN_HORIZON_STEPS = 5; // command periods looked ahead when steering
+	const float TURN_HORIZON_DT = 0.1f; // seconds per command period
+
+	// Takes a change of the vehicle control state; false if it could not be sent.
+	typedef bool (*CommandSink)(void *context, int move_from, int turn_from, int move_to, int turn_to);
+
 	class Controller {
 		friend class PathFind;
 		public:
-			Controller(ProtocolStream *proto_stream) : _proto_stream(proto_stream) {
+			Controller(ProtocolStream *proto_stream) : _sink(toStream), _sink_context(proto_stream), _pending(false), _from_move(ROLLING), _from_turn(STRAIGHT) {
+				// nop
+			}
+			// Sends the commands elsewhere than to the server, e.g. to an in-process simulator.
+			Controller(CommandSink sink, void *context) : _sink(sink), _sink_context(context), _pending(false), _from_move(ROLLING), _from_turn(STRAIGHT) {
 				// nop
 			}
 			ControllerState& state() {
 				return _state;
 			}
 			void accel() {
-				if (_state.accel())
-					_command += "a";
+				begin();
+				_state.accel();
 			}
 			void brake() {
-				if (_state.brake())
-					_command += "b";
+				begin();
+				_state.brake();
 			}
 			void turnRight() {
-				if (_state.turnRight())
-					_command += "r";
+				begin();
+				_state.turnRight();
 			}
 			void turnLeft() {
-				if (_state.turnLeft())
-					_command += "l";
+				begin();
+				_state.turnLeft();
 			}
+			// Queues the state change made since the last call, if any.
 			void execute() {
-				if (!_command.empty()) {
-					std::cout <<  "### command=" << _command
-						<< " [ state.move=" << _state.move
-						<< " state.turn=" << _state.turn
-						<< " ]" << std::endl;
-					_proto_stream->put(_command + ";");
-					_command.clear();
-				}
+				if (!_pending)
+					return;
+				_pending = false;
+				if (_state.move == _from_move && _state.turn == _from_turn)
+					return;
+				LOG_DEBUG("### command=[ " << _from_move << " " << _from_turn
+					<< " -> state.move=" << _state.move
+					<< " state.turn=" << _state.turn
+					<< " ]");
+				if (!_sink(_sink_context, _from_move, _from_turn, _state.move, _state.turn))
+					LOG_WARN("command dropped, outgoing queue full");
 			}
-			void moveTo() {
-				// TODO
+			// Moves the control state one notch towards the command.
+			void steer(const VehicleCommand& command) {
+				if (command.move > _state.move)
+					accel();
+				else if (command.move < _state.move)
+					brake();
+				if (command.turn < _state.turn)
+					turnLeft();
+				else if (command.turn > _state.turn)
+					turnRight();
 			}
+			// Steers towards a point, see turnToDir().
+			void moveTo(const Vector2& target) {
+				VehicleState s = _state.predict();
+				turnToDir(std::atan2(target.y - s.y, target.x - s.x) * 180.0f / M_PI);
+			}
+			//
+			// Steers towards a direction: rolls every turn state out over a short
+			// horizon and moves one notch towards the one ending up closest to it,
+			// so the rover straightens up before overshooting.
+			//
 			void turnToDir(float target_dir) {
-				// TODO
+				VehicleState s = _state.predict();
+				VehicleModel model;
+				model.setParams(_state.vehicleParams());
+				VehicleCommand commands[TURN_HORIZON_STEPS];
+				TurnState best = _state.turn;
+				float best_error = 360.0f;
+				for (TurnState t = HARD_LEFT; t <= HARD_RIGHT; ++t) {
+					for (int k = 0; k < TURN_HORIZON_STEPS; ++k) {
+						commands[k].move = s.move;
+						commands[k].turn = t;
+					}
+					VehicleState end = model.rollout(s, commands, TURN_HORIZON_STEPS, TURN_HORIZON_DT, 2, NULL, NULL);
+					float error = std::fabs(std::fmod(target_dir - end.dir + 540.0f, 360.0f) - 180.0f);
+					if (error < best_error) {
+						best_error = error;
+						best = t;
+					}
+				}
+				if (best < _state.turn)
+					turnLeft();
+				else if (best > _state.turn)
+					turnRight();
 			}
 		protected:
-			ProtocolStream *_proto_stream;
+			// Remembers the state the pending change starts from.
+			void begin() {
+				if (_pending)
+					return;
+				_pending = true;
+				_from_move = _state.move;
+				_from_turn = _state.turn;
+			}
+
+			static bool toStream(void *context, int move_from, int turn_from, int move_to, int turn_to) {
+				return static_cast<ProtocolStream *>(context)->put(move_from, turn_from, move_to, turn_to);
+			}
+
+			CommandSink _sink;
+			void *_sink_context;
 			ControllerState _state;
-			std::string _command;
+			bool _pending;
+			MoveState _from_move;
+			TurnState _from_turn;
 	};
 
 }
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include "vector2.h"
+#include "worldmodel.h"
+
+namespace Movement {
+
+	// Clearance from the inflated obstacles tracked by the distance layer, beyond which it saturates (meters).
+	const float CLEARANCE_RANGE = 4.0f;
+
+	//
+	// Grid of the map marking the cells the rover center must stay out of,
+	// i.e. every obstacle grown by the rover radius and a safety margin.
+	//
+	// Cells are bits, packed in 8x8 tiles of one 64-bit word each, in a
+	// buffer aligned on cache lines: the 3x3 neighborhood a search looks at
+	// is mostly one word, and a 512x512 map takes 32 KB.
+	//
+	// A second layer keeps each cell's chamfer distance to the nearest
+	// blocked one, up to CLEARANCE_RANGE, for clearance costs.
+	//
+	// Obstacles are rasterized once, as the world model learns about them:
+	// sync() only draws the ones appended since the previous call, a row span
+	// of bits at a time, and updates the distances around the cells they
+	// newly blocked only.
+	//
+	class OccupancyGrid {
+		private:
+			// Chamfer steps of the distance layer, close to 1 : sqrt(2).
+			static const int STRAIGHT_STEP = 5;
+			static const int DIAGONAL_STEP = 7;
+
+			int m_width;
+			int m_height;
+			float m_resolution;
+			float m_inflation;
+			int m_stride; // words per row of tiles
+			Vector2 m_origin;
+			std::vector<uint64_t> m_storage;
+			uint64_t *m_bits; // into m_storage, on a cache line boundary
+			std::vector<uint16_t> m_distance; // chamfer steps to the nearest blocked cell, at most m_saturation
+			uint16_t m_saturation;
+			std::vector<int> m_queue;
+			std::vector<int> m_changes;
+			std::size_t m_rasterized; // world model obstacles already drawn
+			unsigned m_generation; // bumped whenever cells are freed again
+
+			// Owns the buffer m_bits points into.
+			OccupancyGrid(const OccupancyGrid&);
+			OccupancyGrid& operator=(const OccupancyGrid&);
+
+		public:
+			OccupancyGrid() : m_width(0), m_height(0), m_resolution(1.0f), m_inflation(0.0f), m_stride(0), m_origin(Vector2::ZERO), m_bits(NULL), m_saturation(0), m_rasterized(0), m_generation(0) {
+				// nop
+			}
+
+			//
+			// Covers a map of map_size meters centered at the origin with cells of
+			// `resolution` meters, growing obstacles by `inflation` meters.
+			// Returns false (and keeps the grid) if nothing changed.
+			//
+			bool reset(const Vector2& map_size, float resolution, float inflation) {
+				int width = static_cast<int>(std::ceil(map_size.x / resolution));
+				int height = static_cast<int>(std::ceil(map_size.y / resolution));
+				if (width == m_width && height == m_height && resolution == m_resolution && inflation == m_inflation)
+					return false;
+				m_width = width;
+				m_height = height;
+				m_resolution = resolution;
+				m_inflation = inflation;
+				m_origin.set(-map_size.x * 0.5f, -map_size.y * 0.5f);
+				m_stride = (m_width + 7) / 8;
+				std::size_t words = static_cast<std::size_t>(m_stride) * ((m_height + 7) / 8);
+				// 8 words to a cache line; the spare ones let the start be rounded up to one.
+				m_storage.assign(words + 7, 0);
+				uintptr_t address = reinterpret_cast<uintptr_t>(&m_storage[0]);
+				m_bits = &m_storage[0] + ((64 - address % 64) % 64) / sizeof(uint64_t);
+				int saturation = static_cast<int>(std::ceil(CLEARANCE_RANGE / m_resolution)) * STRAIGHT_STEP;
+				m_saturation = static_cast<uint16_t>(std::min(saturation, 0xffff));
+				m_distance.assign(static_cast<std::size_t>(m_width) * m_height, m_saturation);
+				m_changes.clear();
+				m_rasterized = 0;
+				++m_generation;
+				return true;
+			}
+
+			//
+			// Draws the obstacles the world model learned since the last call.
+			// Returns how many were drawn.
+			//
+			int sync(const WorldModel& world) {
+				if (world.size() < m_rasterized)
+					clear(); // the world model was cleared, start over
+				std::size_t first_change = m_changes.size();
+				int drawn = 0;
+				for (; m_rasterized < world.size(); ++m_rasterized, ++drawn)
+					fillCircle(world.x[m_rasterized], world.y[m_rasterized], world.radius[m_rasterized] + m_inflation);
+				propagate(first_change);
+				return drawn;
+			}
+			void clear() {
+				if (m_bits != NULL)
+					std::fill(m_storage.begin(), m_storage.end(), 0);
+				std::fill(m_distance.begin(), m_distance.end(), m_saturation);
+				m_changes.clear();
+				m_rasterized = 0;
+				++m_generation;
+			}
+			//
+			// Changes whenever the grid is resized or cleared, i.e. whenever
+			// changes() alone no longer describes what happened to it.
+			//
+			unsigned generation() const {
+				return m_generation;
+			}
+
+			int width() const {
+				return m_width;
+			}
+			int height() const {
+				return m_height;
+			}
+			float resolution() const {
+				return m_resolution;
+			}
+			bool empty() const {
+				return m_bits == NULL;
+			}
+			bool contains(int i, int j) const {
+				return i >= 0 && j >= 0 && i < m_width && j < m_height;
+			}
+			bool blocked(int i, int j) const {
+				return (m_bits[(j >> 3) * m_stride + (i >> 3)] >> (((j & 7) << 3) | (i & 7))) & 1;
+			}
+			bool blocked(int index) const {
+				return blocked(index % m_width, index / m_width);
+			}
+			// Distance from the cell to the nearest blocked one, saturating at CLEARANCE_RANGE (meters).
+			float clearance(int i, int j) const {
+				return m_distance[j * m_width + i] * (m_resolution / STRAIGHT_STEP);
+			}
+
+			int cellX(float px) const {
+				int i = static_cast<int>(std::floor((px - m_origin.x) / m_resolution));
+				return i < 0 ? 0 : (i >= m_width ? m_width - 1 : i);
+			}
+			int cellY(float py) const {
+				int j = static_cast<int>(std::floor((py - m_origin.y) / m_resolution));
+				return j < 0 ? 0 : (j >= m_height ? m_height - 1 : j);
+			}
+			Vector2 center(int i, int j) const {
+				return Vector2(m_origin.x + (i + 0.5f) * m_resolution, m_origin.y + (j + 0.5f) * m_resolution);
+			}
+
+			//
+			// Whether the straight line between the centers of cells a and b (indices)
+			// crosses only free cells. Walks every cell the line touches,
+			// both side cells included when it passes exactly through a corner.
+			// The end cells themselves are not tested.
+			//
+			bool lineOfSight(int a, int b) const {
+				int width = m_width;
+				int x = a % width, y = a / width;
+				int x1 = b % width, y1 = b / width;
+				int dx = std::abs(x1 - x), dy = std::abs(y1 - y);
+				int sx = x1 > x ? 1 : -1, sy = y1 > y ? 1 : -1;
+				int error = dx - dy;
+				dx *= 2;
+				dy *= 2;
+				for (int n = (dx + dy) / 2; n > 0; --n) {
+					if (error > 0) {
+						x += sx;
+						error -= dy;
+					} else if (error < 0) {
+						y += sy;
+						error += dx;
+					} else {
+						if (blocked(x + sx, y) || blocked(x, y + sy))
+							return false;
+						x += sx;
+						y += sy;
+						error += dx - dy;
+						--n;
+					}
+					if (n > 1 && blocked(x, y))
+						return false;
+				}
+				return true;
+			}
+
+			//
+			// Cells that turned blocked since the last clearChanges(), for
+			// planners that repair their search instead of starting over.
+			//
+			const std::vector<int>& changes() const {
+				return m_changes;
+			}
+			void clearChanges() {
+				m_changes.clear();
+			}
+
+		private:
+			// Marks every cell the circle overlaps, however small the circle.
+			void fillCircle(float cx, float cy, float r) {
+				int j0 = cellY(cy - r), j1 = cellY(cy + r);
+				for (int j = j0; j <= j1; ++j) {
+					float row_min = m_origin.y + j * m_resolution;
+					float row_max = row_min + m_resolution;
+					float dy = cy < row_min ? row_min - cy : (cy > row_max ? cy - row_max : 0.0f);
+					float half_sq = r * r - dy * dy;
+					if (half_sq < 0.0f)
+						continue;
+					float half = std::sqrt(half_sq);
+					fillSpan(j, cellX(cx - half), cellX(cx + half));
+				}
+			}
+
+			// Sets cells i0 to i1 of row j, a tile at a time, and notes the ones that were free.
+			void fillSpan(int j, int i0, int i1) {
+				int shift = (j & 7) << 3;
+				uint64_t *row = &m_bits[(j >> 3) * m_stride];
+				for (int i = i0; i <= i1; ) {
+					int word = i >> 3;
+					int first = i & 7;
+					int last = std::min(i1 - (word << 3), 7);
+					uint64_t mask = ((static_cast<uint64_t>(1) << (last - first + 1)) - 1) << (first + shift);
+					uint64_t fresh = mask & ~row[word];
+					row[word] |= mask;
+					while (fresh != 0) {
+						int bit = __builtin_ctzll(fresh) - shift;
+						fresh &= fresh - 1;
+						int index = j * m_width + (word << 3) + bit;
+						m_changes.push_back(index);
+						m_distance[index] = 0;
+					}
+					i = (word + 1) << 3;
+				}
+			}
+
+			//
+			// Lowers the distances around the cells blocked since changes()[first],
+			// wavefront style, stopping where they were already as low.
+			//
+			void propagate(std::size_t first) {
+				static const int DI[] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+				static const int DJ[] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+				m_queue.assign(m_changes.begin() + first, m_changes.end());
+				for (std::size_t q = 0; q < m_queue.size(); ++q) {
+					int u = m_queue[q];
+					int ui = u % m_width, uj = u / m_width;
+					for (int k = 0; k < 8; ++k) {
+						int vi = ui + DI[k], vj = uj + DJ[k];
+						if (!contains(vi, vj))
+							continue;
+						int v = vj * m_width + vi;
+						int d = m_distance[u] + (k < 4 ? STRAIGHT_STEP : DIAGONAL_STEP);
+						if (d < m_distance[v]) {
+							m_distance[v] = static_cast<uint16_t>(d);
+							m_queue.push_back(v);
+						}
+					}
+				}
+			}
+	};
+
+}
@@ -0,0 +1,192 @@
+//
+// Micro-benchmark of the telemetry parser.
+//
+// Compares ProtocolParser against the sscanf-based parser it replaced,
+// reporting nanoseconds per message. Telemetry lines are read from the file
+// given on the command line (one `;`-terminated message per line, as recorded
+// from a server), or synthesized when no file is given.
+//
+#include <string>
+#include <vector>
+#include <list>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include "protocol.h"
+
+using namespace Communication;
+
+namespace {
+
+	// The parser as it was before the single-pass scanner, kept for comparison.
+	typedef std::list<Protocol::Object *> ObjectList;
+
+	void legacyParseTelemetry(Protocol::Message& msg, ObjectList& objects, const char *stream) {
+		static char string_objects[4096];
+		string_objects[0] = '\0'; // was cleared along with the message
+		char msg_tag;
+		sscanf(stream, "%c %d %c%c %f %f %f %f %[-0123456789. bchm] ;",
+			&msg_tag,
+			&msg.telemetry.timestamp,
+			&msg.telemetry.vehicle_ctl[0], &msg.telemetry.vehicle_ctl[1],
+			&msg.telemetry.vehicle_x,
+			&msg.telemetry.vehicle_y,
+			&msg.telemetry.vehicle_dir,
+			&msg.telemetry.vehicle_speed,
+			string_objects
+		);
+		msg.tag = static_cast<Protocol::MessageTag>(msg_tag);
+		msg.telemetry.objects = NULL;
+		for (
+			char *ptr = strpbrk(string_objects, "bchm");
+			ptr != NULL;
+			ptr = strpbrk(ptr+1, "bchm")
+		) {
+			Protocol::Object *obj = new Protocol::Object();
+			objects.push_back(obj);
+			char obj_tag;
+			switch (ptr[0]) {
+				case Protocol::TAG_BOULDER:
+				case Protocol::TAG_CRATER:
+				case Protocol::TAG_HOME:
+					sscanf(ptr, "%c %f %f %f ", &obj_tag, &obj->common.x, &obj->common.y, &obj->common.radius);
+					obj->tag = static_cast<Protocol::ObjectTag>(obj_tag);
+					break;
+				case Protocol::TAG_ENEMY:
+					sscanf(ptr, "%c %f %f %f %f ", &obj_tag, &obj->enemy.x, &obj->enemy.y, &obj->enemy.dir, &obj->enemy.speed);
+					obj->tag = static_cast<Protocol::ObjectTag>(obj_tag);
+					break;
+			}
+		}
+	}
+
+	double coord(unsigned& seed) {
+		seed = seed * 1103515245 + 12345;
+		return ((seed >> 8) % 200000) / 1000.0 - 100.0;
+	}
+
+	std::string synthesize(unsigned seed, int objects) {
+		char buf[64];
+		std::string line;
+		int timestamp = seed * 100;
+		double x = coord(seed), y = coord(seed), dir = coord(seed);
+		snprintf(buf, sizeof(buf), "T %d aL %.3f %.3f %.1f %.3f ", timestamp, x, y, dir, 8.250);
+		line += buf;
+		for (int i = 0; i < objects; ++i) {
+			switch (i % 8) {
+				case 0:
+					x = coord(seed), y = coord(seed), dir = coord(seed);
+					snprintf(buf, sizeof(buf), "m %.3f %.3f %.1f %.3f ", x, y, dir, 4.5);
+					break;
+				case 1:
+					x = coord(seed), y = coord(seed);
+					snprintf(buf, sizeof(buf), "c %.3f %.3f %.3f ", x, y, 4.25);
+					break;
+				default:
+					x = coord(seed), y = coord(seed);
+					snprintf(buf, sizeof(buf), "b %.3f %.3f %.3f ", x, y, 1.5);
+					break;
+			}
+			line += buf;
+		}
+		line += ";";
+		return line;
+	}
+
+	void legacyClear(Protocol::Message& msg, ObjectList& objects) {
+		for (ObjectList::const_iterator iter = objects.begin(); iter != objects.end(); ++iter)
+			delete *iter;
+		objects.clear();
+		msg.clear();
+	}
+
+	double now() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1e9 + ts.tv_nsec;
+	}
+
+}
+
+int main(int argc, char **argv) {
+	std::vector<std::string> lines;
+	if (argc > 1) {
+		std::ifstream in(argv[1]);
+		std::string line;
+		while (std::getline(in, line)) {
+			// The legacy parser cannot take more than 4 KB of objects.
+			if (!line.empty() && line[0] == Protocol::TAG_TELEMETRY_STREAM && line.size() < 4000)
+				lines.push_back(line);
+		}
+		if (lines.empty()) {
+			std::cerr << "no telemetry lines in " << argv[1] << std::endl;
+			return 1;
+		}
+	} else {
+		static const int sizes[] = { 0, 5, 20, 60, 120 };
+		for (unsigned i = 0; i < 500; ++i)
+			lines.push_back(synthesize(i + 1, sizes[i % 5]));
+	}
+
+	// The parser is handed framed messages, which carry no terminator.
+	std::vector<Slice> framed;
+	for (std::size_t i = 0; i < lines.size(); ++i) {
+		std::size_t size = lines[i].find_last_of(LineFramer::TERMINATOR);
+		framed.push_back(Slice(lines[i].data(), size == std::string::npos ? lines[i].size() : size));
+	}
+
+	const int rounds = 200;
+	std::size_t bytes = 0;
+	for (std::size_t i = 0; i < lines.size(); ++i)
+		bytes += lines[i].size();
+
+	ProtocolParser parser;
+	Protocol::Message msg;
+	ObjectList legacy_objects;
+	float checksum = 0.0f;
+
+	// Both parsers must agree before their speed is worth comparing.
+	for (std::size_t i = 0; i < lines.size(); ++i) {
+		Protocol::Message expected;
+		legacyParseTelemetry(expected, legacy_objects, lines[i].c_str());
+		if (!parser.parseMessage(msg, framed[i])
+			|| msg.telemetry.vehicle_x != expected.telemetry.vehicle_x
+			|| msg.telemetry.vehicle_dir != expected.telemetry.vehicle_dir
+			|| msg.telemetry.objects->size() != legacy_objects.size()) {
+			std::cerr << "parsers disagree on: " << lines[i] << std::endl;
+			return 1;
+		}
+		legacyClear(expected, legacy_objects);
+		msg.clear();
+	}
+
+	double start = now();
+	for (int r = 0; r < rounds; ++r) {
+		for (std::size_t i = 0; i < lines.size(); ++i) {
+			legacyParseTelemetry(msg, legacy_objects, lines[i].c_str());
+			checksum += msg.telemetry.vehicle_x;
+			legacyClear(msg, legacy_objects);
+		}
+	}
+	double legacy = (now() - start) / (rounds * lines.size());
+
+	start = now();
+	for (int r = 0; r < rounds; ++r) {
+		for (std::size_t i = 0; i < lines.size(); ++i) {
+			parser.parseMessage(msg, framed[i]);
+			checksum += msg.telemetry.vehicle_x;
+			msg.clear();
+		}
+	}
+	double scanner = (now() - start) / (rounds * lines.size());
+
+	printf("%zu messages, %.0f bytes/message average (checksum %g)\n",
+		lines.size(), (double)bytes / lines.size(), checksum);
+	printf("sscanf:  %10.1f ns/message\n", legacy);
+	printf("scanner: %10.1f ns/message\n", scanner);
+	printf("speedup: %10.2fx\n", legacy / scanner);
+	return 0;
+}
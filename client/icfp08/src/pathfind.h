@@ -3,59 +3,363 @@
 #include <string>
 #include <cmath>
 #include <pthread.h>
+#include <unistd.h>
 #include "protocol.h"
 #include "vision.h"
 #include "movement.h"
+#include "occupancy.h"
+#include "gridplanner.h"
+#include "dstarlite.h"
+#include "visgraph.h"
+#include "regionplanner.h"
+#include "martians.h"
+#include "localplanner.h"
+#include "recorder.h"
+#include "log.h"
+#include "timing.h"
 
 namespace Movement {
 
 	void *threadFunc(void *arg);
 
+	const int PREDICTION_STEPS = 30; // Martians are predicted this many steps ahead
+	const float PREDICTION_STEP = 0.1f; // seconds between prediction steps
+	const float PREDICTION_GROWTH = 0.3f; // meters a predicted Martian widens per second
+	// Fractions of the maximum speed tried, fastest first, when Martians get in the way.
+	const float SPEED_CHOICES[] = { 1.0f, 0.6f, 0.3f, 0.0f };
+	const int SPEED_CHOICE_COUNT = sizeof(SPEED_CHOICES) / sizeof(SPEED_CHOICES[0]);
+	const float CORNER_SLACK = 1.5f; // meters the waypoint follower may run wide of a turn
+
+	//
+	// What a planner tick started from and what it decided, as recorded: a
+	// replay feeding the same messages up to `telemetry_count` and
+	// extrapolating by `elapsed` must come to the same decision.
+	//
+	struct TickRecord {
+		int32_t telemetry_count; // of the snapshot planned on
+		float elapsed; // seconds the vehicle was predicted ahead by
+		int8_t move_before;
+		int8_t turn_before;
+		int8_t move_after;
+		int8_t turn_after;
+		int32_t plan; // GridPlanner::Result of the path search
+		float path_length; // meters
+		float local_cost; // of the LocalPlanner's pick, 0 without it
+	};
+
 	class PathFind {
 		private:
 			Controller *m_controller;
 			Vision m_vision;
+			OccupancyGrid m_grid;
+			GridPlanner m_planner;
+			IncrementalPlanner m_incremental;
+			VisibilityPlanner m_visibility;
+			RegionPlanner m_regions;
+			LocalPlanner m_local;
 			pthread_t m_thread;
 		public:
-			PathFind(Controller *controller) {
+			enum Planner {
+				THETA_STAR,		// any-angle search from scratch every tick
+				A_STAR,			// 8-connected search from scratch every tick
+				INCREMENTAL,	// D* Lite, repaired as obstacles show up
+				VISIBILITY,		// tangents and arcs around the obstacles themselves
+				HIERARCHICAL	// Theta* confined to a coarse route over free regions, kept across runs
+			};
+
+			// Cells along the longest side of the planning grid, at most (cells are 1 m or larger).
+			static const int MAX_GRID_CELLS_PER_SIDE = 512;
+			// Above this heading error the vehicle slows down to turn (degrees).
+			static const int SHARP_TURN = 45;
+
+			//
+			// Adjusts the course from a thread of its own, once per telemetry
+			// message, unless `threaded` is false: then the caller runs
+			// adjustCourse() itself, as a simulator stepping in lockstep does.
+			// The local planner gets `local_threads` helper threads, or one per
+			// spare core if negative.
+			//
+			PathFind(Controller *controller, bool threaded = true, int local_threads = -1) : m_local(local_threads < 0 ? spareCores() : local_threads), m_planner_kind(INCREMENTAL), m_local_planning(true), m_threaded(threaded), m_stopped(false), m_recorder(NULL), m_planning_usec(0), m_martian_count(0), m_martian_clearance(0.0f) {
 				m_controller = controller;
-				pthread_create(&m_thread, 0, threadFunc, this);
+				if (m_threaded)
+					pthread_create(&m_thread, 0, threadFunc, this);
 			}
 			~PathFind() {
-				pthread_kill(m_thread, 9);
+				stop();
+			}
+			// Stops adjusting the course once the current tick is over.
+			void stop() {
+				if (m_stopped)
+					return;
+				m_stopped = true;
+				m_controller->state().stop();
+				if (m_threaded)
+					pthread_join(m_thread, NULL);
+			}
+
+			// Adjusts the course once per telemetry message, until the controller stops.
+			void run() {
+				int seen = 0;
+				while ((seen = m_controller->state().waitForTelemetry(seen)) != -1)
+					adjustCourse();
+			}
+
+			//
+			// Time budget of the path search run every tick (microseconds).
+			//
+			void setPlanningBudget(long usec) {
+				m_planner.setBudget(usec);
+				m_incremental.setBudget(usec);
+				m_visibility.setBudget(usec);
+				m_regions.setBudget(usec);
+			}
+			// Planner named theta, astar, dstar, visibility or regions; false if none is.
+			static bool plannerNamed(const char *name, Planner& planner) {
+				static const char *names[] = { "theta", "astar", "dstar", "visibility", "regions" };
+				for (int i = 0; i <= HIERARCHICAL; ++i) {
+					if (std::string(name) == names[i]) {
+						planner = static_cast<Planner>(i);
+						return true;
+					}
+				}
+				return false;
+			}
+			void setPlanner(Planner planner) {
+				m_planner_kind = planner;
+				m_planner.setAnyAngle(planner == THETA_STAR);
+				// Grid changes are not tracked while another planner runs.
+				m_incremental.invalidate();
+				m_regions.invalidate();
+			}
+			// Steer with the LocalPlanner rollouts, rather than heading for the next waypoint.
+			void setLocalPlanning(bool enabled) {
+				m_local_planning = enabled;
+			}
+			// Records a TickRecord per tick, if not NULL.
+			void setRecorder(Recorder *recorder) {
+				m_recorder = recorder;
+			}
+			const TickRecord& lastTick() const {
+				return m_tick;
+			}
+			const std::vector<Vector2>& path() const {
+				switch (m_planner_kind) {
+					case INCREMENTAL: return m_incremental.path();
+					case VISIBILITY: return m_visibility.path();
+					case HIERARCHICAL: return m_regions.path();
+					default: return m_planner.path();
+				}
+			}
+			float pathLength() const {
+				float length = 0.0f;
+				for (std::size_t i = 1; i < path().size(); ++i)
+					length += (path()[i] - path()[i-1]).length();
+				return length;
+			}
+			// Time taken by the last path search (microseconds).
+			long planningTime() const {
+				return m_planning_usec;
+			}
+			const IncrementalPlanner::Stats& incrementalStats() const {
+				return m_incremental.stats();
+			}
+			const RegionPlanner::Stats& regionStats() const {
+				return m_regions.stats();
 			}
 
 			void adjustCourse() {
-				// TODO Begin of test -- REMOVE IT
-				m_controller->state().expected.vehicle_speed = 5.0;
-				m_controller->state().expected.vehicle_dir = -40.0;
-				std::cout << "DEBUG: "
-					<< " speed=" << m_controller->state().current.vehicle_speed
-					<< " dir=" << m_controller->state().current.vehicle_dir
-					<< " angle_between=" << calcAngleBetween(
-						m_controller->state().current.vehicle_pos,
-						m_controller->state().expected.vehicle_pos)
-					<< " distance_between=" << calcDistanceBetween(
-						m_controller->state().current.vehicle_pos,
-						m_controller->state().expected.vehicle_pos)
-					<< std::endl;
-				// TODO End of test -- REMOVE IT
-				if (currentSpeed() < expectedSpeed())
-					m_controller->accel();
-				else if (currentSpeed() > expectedSpeed())
-					m_controller->brake();
-				if (currentDirection() < expectedDirection())
-					m_controller->turnLeft();
-				else if (currentDirection() > expectedDirection())
-					m_controller->turnRight();
+				StageTimer timer(Timings::PLAN);
+				ControllerState& state = m_controller->state();
+				state.refresh();
+				Timings::instance().planning(state.current.time_stamp);
+				TickRecord& tick = m_tick;
+				tick.telemetry_count = state.current.telemetry_count;
+				tick.elapsed = state.elapsed();
+				tick.move_before = static_cast<int8_t>(state.move);
+				tick.turn_before = static_cast<int8_t>(state.turn);
+				// Plan from where the vehicle is by now, not where the last telemetry saw it.
+				m_vehicle = state.predict(0.0f, &m_time);
+				Vector2 position(m_vehicle.x, m_vehicle.y);
+				const Vector2& map_size = state.current.map_size;
+				float resolution = std::max(1.0f, std::max(map_size.x, map_size.y) / MAX_GRID_CELLS_PER_SIDE);
+				m_grid.reset(map_size, resolution, VEHICLE_RADIUS + SAFETY_MARGIN);
+				m_grid.sync(state.world);
+				struct timespec started, finished;
+				clock_gettime(CLOCK_MONOTONIC, &started);
+				GridPlanner::Result result;
+				if (m_planner_kind == INCREMENTAL) {
+					result = m_incremental.plan(m_grid, position, Vector2::ZERO);
+				} else if (m_planner_kind == VISIBILITY) {
+					// Ways ahead of the vehicle are kept over those it would turn around for.
+					float dir = m_vehicle.dir * static_cast<float>(M_PI) / 180.0f;
+					float rate = state.vehicleParams().hard_turn * static_cast<float>(M_PI) / 180.0f;
+					m_visibility.setHeading(Vector2(std::cos(dir), std::sin(dir)), rate > 0.0f ? m_vehicle.speed / rate : 0.0f);
+					result = m_visibility.plan(state.world, position, Vector2::ZERO, VEHICLE_RADIUS + SAFETY_MARGIN);
+				} else if (m_planner_kind == HIERARCHICAL) {
+					result = m_regions.plan(state.world, m_grid, position, Vector2::ZERO, VEHICLE_RADIUS + SAFETY_MARGIN);
+				} else {
+					result = m_planner.plan(m_grid, position, Vector2::ZERO);
+				}
+				m_grid.clearChanges();
+				clock_gettime(CLOCK_MONOTONIC, &finished);
+				m_planning_usec = (finished.tv_sec - started.tv_sec) * 1000000 + (finished.tv_nsec - started.tv_nsec) / 1000;
+				if (result != GridPlanner::NO_PATH && path().size() > 1) {
+					Vector2 heading = path()[1] - position;
+					state.expected.vehicle_dir = std::atan2(heading.y, heading.x) * 180.0f / M_PI;
+				} else {
+					// Nowhere to go, head straight home and hope for the best.
+					state.expected.vehicle_dir = std::atan2(-position.y, -position.x) * 180.0f / M_PI;
+				}
+				if (m_local_planning) {
+					steerLocally();
+				} else {
+					float error = headingError();
+					state.expected.vehicle_speed = std::fabs(error) > SHARP_TURN
+						? state.current.max_speed * 0.3f
+						: state.current.max_speed;
+					state.expected.vehicle_speed = cornerSpeed(state.expected.vehicle_speed);
+					state.expected.vehicle_speed = avoidMartians(state.expected.vehicle_speed);
+					if (currentSpeed() < expectedSpeed())
+						m_controller->accel();
+					else if (currentSpeed() > expectedSpeed())
+						m_controller->brake();
+					m_controller->turnToDir(expectedDirection());
+				}
+				LOG_DEBUG("speed=" << currentSpeed()
+					<< " dir=" << currentDirection()
+					<< " expected_dir=" << expectedDirection()
+					<< " plan=" << result
+					<< " waypoints=" << path().size()
+					<< " length=" << pathLength()
+					<< " usec=" << m_planning_usec
+					<< " martians=" << m_martian_count
+					<< " clearance=" << m_martian_clearance
+					<< " local_cost=" << (m_local_planning ? m_local.result().cost : 0.0f)
+					<< " local_usec=" << (m_local_planning ? m_local.result().usec : 0L));
 				m_controller->execute();
+				tick.move_after = static_cast<int8_t>(state.move);
+				tick.turn_after = static_cast<int8_t>(state.turn);
+				tick.plan = result;
+				tick.path_length = pathLength();
+				tick.local_cost = m_local_planning ? m_local.result().cost : 0.0f;
+				if (m_recorder != NULL)
+					m_recorder->record(RecordHeader::TICK, &tick, sizeof(tick));
+			}
+
+			//
+			// Sends the first command of the best local rollout.
+			//
+			void steerLocally() {
+				ControllerState& state = m_controller->state();
+				VehicleModel model;
+				model.setParams(state.vehicleParams());
+				m_martian_count = static_cast<int>(state.martians.size());
+				if (state.martians.size() > 0)
+					state.martians.predict(m_time, PREDICTION_STEPS, PREDICTION_STEP, PREDICTION_GROWTH);
+				const LocalPlanner::Result& local = m_local.plan(model, m_vehicle, PREDICTION_STEP, state.world, m_grid, state.martians, path());
+				m_martian_clearance = local.clearance;
+				m_controller->steer(local.command);
+			}
+
+			//
+			// Fastest speed, up to `wanted`, from which the vehicle can still brake
+			// down to the speed it may reach each leg of the path ahead at: turning
+			// hard from its heading, it must not run wider than CORNER_SLACK.
+			//
+			float cornerSpeed(float wanted) const {
+				const VehicleParams& params = m_controller->state().vehicleParams();
+				const std::vector<Vector2>& waypoints = path();
+				float rate = params.hard_turn * static_cast<float>(M_PI) / 180.0f;
+				float dir = m_vehicle.dir * static_cast<float>(M_PI) / 180.0f;
+				Vector2 heading(std::cos(dir), std::sin(dir));
+				Vector2 at(m_vehicle.x, m_vehicle.y);
+				float speed = wanted;
+				float along = 0.0f;
+				for (std::size_t k = 1; k < waypoints.size() && along * 2.0f * params.brake < speed * speed; ++k) {
+					Vector2 leg = waypoints[k] - at;
+					float length = leg.length();
+					if (length > 0.0f) {
+						float wide = 1.0f - std::max(0.0f, heading.dot(leg) / length);
+						if (wide > 0.0f) {
+							float corner = rate * CORNER_SLACK / wide;
+							speed = std::min(speed, std::sqrt(corner * corner + 2.0f * params.brake * along));
+						}
+					}
+					along += length;
+					at = waypoints[k];
+				}
+				return speed;
+			}
+
+			//
+			// Fastest speed, up to `wanted`, at which following the path keeps
+			// clear of the predicted Martians. Every choice is sampled along the
+			// path and checked in a single batch.
+			//
+			float avoidMartians(float wanted) {
+				ControllerState& state = m_controller->state();
+				m_martian_count = static_cast<int>(state.martians.size());
+				m_martian_clearance = 0.0f;
+				if (state.martians.size() == 0)
+					return wanted;
+				state.martians.predict(m_time, PREDICTION_STEPS, PREDICTION_STEP, PREDICTION_GROWTH);
+				m_sample_x.resize(SPEED_CHOICE_COUNT * PREDICTION_STEPS);
+				m_sample_y.resize(SPEED_CHOICE_COUNT * PREDICTION_STEPS);
+				for (int c = 0; c < SPEED_CHOICE_COUNT; ++c)
+					sampleAlongPath(std::min(wanted, state.current.max_speed * SPEED_CHOICES[c]),
+						&m_sample_x[c * PREDICTION_STEPS], &m_sample_y[c * PREDICTION_STEPS]);
+				float clearance[SPEED_CHOICE_COUNT];
+				state.martians.clearances(&m_sample_x[0], &m_sample_y[0], PREDICTION_STEPS, SPEED_CHOICE_COUNT, VEHICLE_RADIUS, clearance);
+				// Stopping is the last resort; if nothing is safe, take the roomiest.
+				int best = 0;
+				for (int c = 0; c < SPEED_CHOICE_COUNT; ++c) {
+					if (clearance[c] >= SAFETY_MARGIN) {
+						best = c;
+						break;
+					}
+					if (clearance[c] > clearance[best])
+						best = c;
+				}
+				m_martian_clearance = clearance[best];
+				return std::min(wanted, state.current.max_speed * SPEED_CHOICES[best]);
+			}
+
+			//
+			// Positions along the current path at PREDICTION_STEP intervals,
+			// moving at a constant speed from the vehicle position.
+			//
+			void sampleAlongPath(float speed, float *xs, float *ys) const {
+				const std::vector<Vector2>& waypoints = path();
+				Vector2 at(m_vehicle.x, m_vehicle.y);
+				std::size_t next = 1;
+				for (int k = 0; k < PREDICTION_STEPS; ++k) {
+					xs[k] = at.x;
+					ys[k] = at.y;
+					float left = speed * PREDICTION_STEP;
+					while (left > 0.0f && next < waypoints.size()) {
+						Vector2 leg = waypoints[next] - at;
+						float length = leg.length();
+						if (length <= left) {
+							at = waypoints[next++];
+							left -= length;
+						} else {
+							at += leg * (left / length);
+							left = 0.0f;
+						}
+					}
+				}
+			}
+
+			// Counterclockwise angle from the current to the expected direction, in [-180, 180).
+			float headingError() {
+				return std::fmod(expectedDirection() - currentDirection() + 540.0f, 360.0f) - 180.0f;
 			}
 
 			float currentSpeed() {
-				return m_controller->state().current.vehicle_speed;
+				return m_vehicle.speed;
 			}
 			float currentDirection() {
-				return m_controller->state().current.vehicle_dir;
+				return m_vehicle.dir;
 			}
 			float expectedSpeed() {
 				return m_controller->state().expected.vehicle_speed;
@@ -73,19 +377,34 @@ namespace Movement {
 				return acos(n1.dot(n2));
 			}
 			float calcDistanceBetween(const Vector2& v1, const Vector2& v2) const {
-				return std::sqrt(std::pow(v2.x-v1.x, 2) + std::pow(v2.y-v1.y, 2));
+				return (v2 - v1).length();
+			}
+
+		private:
+			// One local planning thread per core, besides this one.
+			static int spareCores() {
+				long cores = sysconf(_SC_NPROCESSORS_ONLN);
+				return cores > 1 ? static_cast<int>(cores - 1) : 0;
 			}
 
+			Planner m_planner_kind;
+			bool m_local_planning;
+			bool m_threaded;
+			bool m_stopped;
+			Recorder *m_recorder;
+			TickRecord m_tick; // of the last tick
+			long m_planning_usec;
+			VehicleState m_vehicle; // predicted at the start of the tick
+			int m_time; // server time of m_vehicle (milliseconds)
+			int m_martian_count; // Martians tracked in the last tick
+			float m_martian_clearance; // predicted clearance from them at the chosen speed (meters)
+			std::vector<float> m_sample_x; // candidate trajectories, one row per speed choice
+			std::vector<float> m_sample_y;
 	};
 
 	void *threadFunc(void *arg) {
 		PathFind *finder = static_cast<PathFind *>(arg); // I know, casting sucks.
-		// TODO This is a temporary ugly hack, and should be replaced by proper synchronization
-		sleep(3); // Wait until struct m_controller->state.current is initialized
-		while (true) {
-			finder->adjustCourse();
-			usleep(100000);
-		}
+		finder->run();
 		return 0;
 	}
 
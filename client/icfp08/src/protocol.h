@@ -3,9 +3,20 @@
 #include "common.h"
 #include <string>
 #include <vector>
-#include <list>
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
 #include "lock.h"
+#include "socket.h"
+#include "eventloop.h"
+#include "spscqueue.h"
+#include "framer.h"
+#include "recorder.h"
+#include "log.h"
+#include "timing.h"
+#include "scanner.h"
 
 namespace Communication {
 
@@ -92,6 +103,101 @@ namespace Communication {
 				}
 			};
 
+			//
+			// Objects of a telemetry message, one contiguous array per field and per tag,
+			// so consumers can scan them with plain linear loops. clear() keeps the
+			// capacity, hence a store reused across messages stops allocating once it
+			// has seen the busiest tick.
+			//
+			struct CircleArray {
+				std::vector<float> x;
+				std::vector<float> y;
+				std::vector<float> radius;
+				std::size_t size() const {
+					return x.size();
+				}
+				bool empty() const {
+					return x.empty();
+				}
+				void push(const ObjectCommon& obj) {
+					x.push_back(obj.x);
+					y.push_back(obj.y);
+					radius.push_back(obj.radius);
+				}
+				ObjectCommon at(std::size_t i) const {
+					ObjectCommon obj = { x[i], y[i], radius[i] };
+					return obj;
+				}
+				void clear() {
+					x.clear();
+					y.clear();
+					radius.clear();
+				}
+			};
+			struct MartianArray {
+				std::vector<float> x;
+				std::vector<float> y;
+				std::vector<float> dir;
+				std::vector<float> speed;
+				std::size_t size() const {
+					return x.size();
+				}
+				bool empty() const {
+					return x.empty();
+				}
+				void push(const ObjectMartian& obj) {
+					x.push_back(obj.x);
+					y.push_back(obj.y);
+					dir.push_back(obj.dir);
+					speed.push_back(obj.speed);
+				}
+				ObjectMartian at(std::size_t i) const {
+					ObjectMartian obj = { x[i], y[i], dir[i], speed[i] };
+					return obj;
+				}
+				void clear() {
+					x.clear();
+					y.clear();
+					dir.clear();
+					speed.clear();
+				}
+			};
+			struct ObjectStore {
+				CircleArray boulders;
+				CircleArray craters;
+				CircleArray homes;
+				MartianArray martians;
+				std::size_t size() const {
+					return boulders.size() + craters.size() + homes.size() + martians.size();
+				}
+				void clear() {
+					boulders.clear();
+					craters.clear();
+					homes.clear();
+					martians.clear();
+				}
+				CircleArray *circles(ObjectTag tag) {
+					switch (tag) {
+						case TAG_BOULDER: return &boulders;
+						case TAG_CRATER: return &craters;
+						case TAG_HOME: return &homes;
+						default: return NULL;
+					}
+				}
+				inline friend std::ostream& operator<<(std::ostream& o, const ObjectStore& v) {
+					const char *sep = "";
+					for (std::size_t i = 0; i < v.boulders.size(); ++i, sep = ", ")
+						o << sep << "b " << v.boulders.at(i);
+					for (std::size_t i = 0; i < v.craters.size(); ++i, sep = ", ")
+						o << sep << "c " << v.craters.at(i);
+					for (std::size_t i = 0; i < v.homes.size(); ++i, sep = ", ")
+						o << sep << "h " << v.homes.at(i);
+					for (std::size_t i = 0; i < v.martians.size(); ++i, sep = ", ")
+						o << sep << "m " << v.martians.at(i);
+					return o;
+				}
+			};
+
 			//
 			// Messages
 			//
@@ -116,37 +222,21 @@ namespace Communication {
 				}
 			};
 			struct MessageTelemetryStream {
-				typedef std::list<Protocol::Object *> ObjectList;
 				int timestamp; // milliseconds
 				char vehicle_ctl[2]; // char
 				float vehicle_x; // meters
 				float vehicle_y; // meters
 				float vehicle_dir; // counterclockwise angle from the x-axis in degrees
 				float vehicle_speed; // meters per second
-				char string_objects[4096]; // TODO fixed size? should find a better solution...
-				ObjectList *objects;
+				ObjectStore *objects; // owned by the parser, reused by every message
 				void clear() {
 					if (objects != NULL) {
-						for (ObjectList::const_iterator iter = objects->begin(); iter != objects->end(); ++iter) {
-							delete *iter;
-						}
 						objects->clear();
-						SAFE_DELETE(objects);
+						objects = NULL;
 					}
 					timestamp = 0;
 					memset(vehicle_ctl, 0, sizeof(vehicle_ctl));
 					vehicle_x = vehicle_y = vehicle_dir = vehicle_speed = 0.0f;
-					memset(string_objects, 0, sizeof(string_objects));
-				}
-				inline friend std::ostream& operator<<(std::ostream& o, const ObjectList& v) {
-					Object *obj;
-					for (ObjectList::const_iterator iter = v.begin(); iter != v.end(); ) {
-						obj = *iter;
-						o << *obj;
-						if (++iter != v.end())
-							o << ", ";
-					}
-					return o;
 				}
 				inline friend std::ostream& operator<<(std::ostream& o, const MessageTelemetryStream& v) {
 					o << "MessageTelemetryStream { "
@@ -154,8 +244,10 @@ namespace Communication {
 						<< v.vehicle_ctl[0] << v.vehicle_ctl[1] << ", "
 						<< v.vehicle_x  << ", " << v.vehicle_y << ", "
 						<< v.vehicle_dir << ", "
-						<< v.vehicle_speed << ", "
-						<< v.objects << " }";
+						<< v.vehicle_speed;
+					if (v.objects != NULL)
+						o << ", " << *v.objects;
+					o << " }";
 					return o;
 				}
 			};
@@ -193,6 +285,7 @@ namespace Communication {
 					switch (tag) {
 						case TAG_INITIALIZATION: initialization.clear(); break;
 						case TAG_TELEMETRY_STREAM: telemetry.clear(); break;
+						case TAG_CRASH:
 						case TAG_KILLED_BY_MARTIAN:
 						case TAG_FELL_INTO_CRATER:
 						case TAG_SUCCESS:
@@ -205,228 +298,363 @@ namespace Communication {
 			};
 	};
 
-	class StreamBuffer {
-		public:
-			std::list<std::string> m_buffer;
-			Lock m_lock;
+	//
+	// A change of the vehicle control state requested by the planner. States
+	// are numbered like the protocol steps them: move -1 (braking) to 1
+	// (accelerating), turn -2 (hard left) to 2 (hard right).
+	//
+	struct OutgoingCommand {
+		signed char move_from;
+		signed char turn_from;
+		signed char move_to;
+		signed char turn_to;
+		struct timespec queued; // monotonic clock
+		int time_stamp; // of the telemetry it was decided on (milliseconds)
+
+		//
+		// Writes the commands stepping the control state from one state to
+		// another, each with its terminator, and returns how many characters.
+		// The server only takes `a`, `b`, `l`, `r`, `al`, `ar`, `bl` and `br`,
+		// i.e. at most one step of each, so a larger change takes several
+		// commands, e.g. `ar;r;`. `text` must hold MAX_TEXT characters.
+		//
+		static const std::size_t MAX_TEXT = 9; // "ar;r;r;r;", across both ranges
+		static std::size_t commands(int move_from, int turn_from, int move_to, int turn_to, char *text) {
+			std::size_t length = 0;
+			while (move_from != move_to || turn_from != turn_to) {
+				if (move_from < move_to) {
+					text[length++] = 'a';
+					++move_from;
+				} else if (move_from > move_to) {
+					text[length++] = 'b';
+					--move_from;
+				}
+				if (turn_from < turn_to) {
+					text[length++] = 'r';
+					++turn_from;
+				} else if (turn_from > turn_to) {
+					text[length++] = 'l';
+					--turn_from;
+				}
+				text[length++] = ';';
+			}
+			return length;
+		}
+
+		//
+		// Reads one command, without its terminator, as the steps it takes
+		// the move and turn states by. False if the server would reject it.
+		//
+		static bool parse(const char *text, std::size_t length, int& move, int& turn) {
+			move = turn = 0;
+			std::size_t i = 0;
+			if (i < length && (text[i] == 'a' || text[i] == 'b'))
+				move = text[i++] == 'a' ? 1 : -1;
+			if (i < length && (text[i] == 'l' || text[i] == 'r'))
+				turn = text[i++] == 'r' ? 1 : -1;
+			return i == length && i > 0;
+		}
+	};
+
+	//
+	// How long commands waited between being queued and being written.
+	//
+	struct WriterStats {
+		unsigned long commands; // popped off the queue
+		unsigned long cancelled; // undone by later commands before being sent
+		unsigned long writes; // to the socket, that wrote something
+		unsigned long bytes; // written
+		unsigned long retries; // writes of what an earlier one left
+		long total_usec;
+		long max_usec;
+
+		WriterStats() : commands(0), cancelled(0), writes(0), bytes(0), retries(0), total_usec(0), max_usec(0) {
+			// nop
+		}
+		void add(long usec) {
+			++commands;
+			total_usec += usec;
+			if (usec > max_usec)
+				max_usec = usec;
+		}
+		long meanUsec() const {
+			return commands > 0 ? total_usec / static_cast<long>(commands) : 0;
+		}
+		inline friend std::ostream& operator<<(std::ostream& o, const WriterStats& v) {
+			o << v.commands << " commands in " << v.writes << " writes of " << v.bytes << " bytes, "
+				<< v.retries << " retried, " << v.cancelled << " cancelled, queued for "
+				<< v.meanUsec() << " usec on average, " << v.max_usec << " at most";
+			return o;
+		}
 	};
 
 	class ProtocolStream {
 		private:
+			// Commands in flight, at most. The planner queues two or three a tick.
+			static const std::size_t OUTGOING_CAPACITY = 64;
+
 			Socket *m_socket;
-			StreamBuffer m_incoming;
-			StreamBuffer m_outgoing;
+			LineFramer m_incoming;
+			SpscQueue<OutgoingCommand> m_outgoing; // planner thread to I/O thread
+			EventLoop *m_loop;
+			WriterStats m_stats; // I/O thread's
+			Recorder *m_recorder;
+			char m_unsent[OutgoingCommand::MAX_TEXT]; // commands the socket did not take yet
+			std::size_t m_unsent_begin;
+			std::size_t m_unsent_end;
+			int m_unsent_time_stamp; // of the telemetry they were decided on
 		public:
-			ProtocolStream(Socket& socket) {
+			ProtocolStream(Socket& socket) : m_outgoing(OUTGOING_CAPACITY), m_loop(NULL), m_recorder(NULL), m_unsent_begin(0), m_unsent_end(0), m_unsent_time_stamp(0) {
 				m_socket = &socket;
 			}
-			void put(const std::string& message) {
-				ScopeLock lock(&m_outgoing.m_lock);
-				m_outgoing.m_buffer.push_back(message);
+			// Wakes the loop whenever a message is put, so it gets flushed right
+			// away. The loop must call flush() once the socket is writable
+			// again, see EventLoop::watch().
+			void attach(EventLoop *loop) {
+				m_loop = loop;
 			}
-			bool get(std::string& message) {
-				ScopeLock lock(&m_incoming.m_lock);
-				if (m_incoming.m_buffer.empty())
+			//
+			// Queues a control state change for the I/O thread to send, from a
+			// single thread. False if the queue is full.
+			//
+			bool put(int move_from, int turn_from, int move_to, int turn_to) {
+				OutgoingCommand command;
+				command.move_from = static_cast<signed char>(move_from);
+				command.turn_from = static_cast<signed char>(turn_from);
+				command.move_to = static_cast<signed char>(move_to);
+				command.turn_to = static_cast<signed char>(turn_to);
+				clock_gettime(CLOCK_MONOTONIC, &command.queued);
+				command.time_stamp = Timings::instance().planned();
+				if (!m_outgoing.push(command))
 					return false;
-				message = m_incoming.m_buffer.front();
-				m_incoming.m_buffer.pop_front();
+				if (m_loop != NULL)
+					m_loop->wake();
 				return true;
 			}
+			const SpscQueue<OutgoingCommand>& outgoing() const {
+				return m_outgoing;
+			}
+			const WriterStats& writerStats() const {
+				return m_stats;
+			}
+			//
+			// Hands out the next complete message received by poll().
+			// The slice points into the receive buffer and is valid until the next poll().
+			//
+			bool get(Slice& message) {
+				if (!m_incoming.next(message))
+					return false;
+				if (m_recorder != NULL)
+					m_recorder->record(RecordHeader::RECEIVED, message.data, message.size);
+				return true;
+			}
+			// Records every message received and every command sent, if not NULL.
+			void setRecorder(Recorder *recorder) {
+				m_recorder = recorder;
+			}
+			//
+			// Reads whatever the socket has. False once the server has closed
+			// the connection or reading failed.
+			//
+			bool receive() {
+				int bytes = 0;
+				m_incoming.reclaim();
+				while (m_incoming.space() > 0 && (bytes = m_socket->read(m_incoming.tail(), m_incoming.space())) > 0) {
+					m_incoming.commit(bytes);
+				}
+				return bytes > 0 || (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+			}
+			//
+			// Sends everything queued in a single write, as the commands going
+			// from the state before the first pending change to the state after
+			// the last one, so changes undone in the meantime are never sent.
+			//
+			// Whatever the socket does not take is kept and written first by
+			// the next flush(); until then, new changes stay queued and keep
+			// coalescing.
+			//
+			void flush() {
+				if (m_unsent_begin < m_unsent_end) {
+					++m_stats.retries;
+					if (!send())
+						return;
+				}
+				OutgoingCommand command;
+				if (!m_outgoing.pop(command))
+					return;
+				struct timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				int move = command.move_from, turn = command.turn_from;
+				unsigned long popped = 0;
+				do {
+					m_stats.add((now.tv_sec - command.queued.tv_sec) * 1000000 + (now.tv_nsec - command.queued.tv_nsec) / 1000);
+					++popped;
+				} while (m_outgoing.pop(command));
+				m_unsent_begin = 0;
+				m_unsent_end = OutgoingCommand::commands(move, turn, command.move_to, command.turn_to, m_unsent);
+				if (m_unsent_end == 0) {
+					m_stats.cancelled += popped;
+					return;
+				}
+				m_unsent_time_stamp = command.time_stamp;
+				send();
+			}
 			void poll() {
-				// This function is a complete mess... not written by me.
 				// receive commands
-				static char incoming_buffer[1024];
-				char tmp_buf[1024];
-				static char last_buf[1024];
-				int bytes;
-				int x, y;
-
-				while ((bytes = m_socket->read(tmp_buf, 1023-strlen(last_buf))) > 0) {
-					// TODO review if every command is complete (terminates with \n)
-					for (x=0; x<strlen(last_buf); x++) {
-						incoming_buffer[x] = last_buf[x];
-					}
-					for (; x<strlen(last_buf)+bytes; x++) {
-						incoming_buffer[x] = tmp_buf[x-strlen(last_buf)];
-					}
-
-					incoming_buffer[bytes+strlen(last_buf)] = 0;
-					for (x=0; x<=1023; x++)
-						last_buf[x] = 0;
-					for (x=bytes; x>0; x--) {
-						if (incoming_buffer[x] == ';' && x < bytes)
-							break;
-					}
-					x++;
-					for (y=0;y<(bytes-x);y++) {
-						last_buf[y] = incoming_buffer[x+y];
-					}
-					incoming_buffer[x] = 0;
-					//cout << "LAST_BUF:" << last_buf << endl;
-					m_incoming.m_lock.acquire();
-					stringTokenize(incoming_buffer, m_incoming.m_buffer, "\n");
-					m_incoming.m_lock.release();
-				}
-//				// receive commands
-//				static char incoming_buffer[1024];
-//				static string m_incoming_rest;
-//				int bytes;
-//				sleep(2);
-//				while ((bytes = m_socket->read(incoming_buffer, 1023)) > 0) {
-//						incoming_buffer[bytes] = 0;
-//						// TODO review if every command is complete (terminates with \n)
-//						m_incoming.m_lock.acquire();
-//						stringTokenize(incoming_buffer, m_incoming.m_buffer, m_incoming_rest, "\n");
-//						m_incoming.m_lock.release();
-//				}
+				receive();
 				// send commands
-				static const char *outgoing_buffer;
-				while (!m_outgoing.m_buffer.empty()) {
-					m_outgoing.m_lock.acquire();
-					outgoing_buffer = m_outgoing.m_buffer.front().c_str();
-					m_socket->write((void *)outgoing_buffer, strlen(outgoing_buffer));
-					m_outgoing.m_buffer.pop_front();
-					m_outgoing.m_lock.release();
-				}
+				flush();
 			}
-			void stringTokenize(
-				const std::string& str,
-				std::list<std::string>& tokens,
-				const std::string& delimiters
-			) {
-				// Skip delimiters at beginning.
-				std::string::size_type lastPos = str.find_first_not_of(delimiters, 0);
-				// Find first "non-delimiter".
-				std::string::size_type pos = str.find_first_of(delimiters, lastPos);
-				while (std::string::npos != pos || std::string::npos != lastPos) {
-					// Found a token, add it to the vector.
-					tokens.push_back(str.substr(lastPos, pos - lastPos));
-					// Skip delimiters.  Note the "not_of"
-					lastPos = str.find_first_not_of(delimiters, pos);
-					// Find next "non-delimiter"
-					pos = str.find_first_of(delimiters, lastPos);
+
+		private:
+			// Writes what is left of the last commands; true once all of it is sent.
+			bool send() {
+				int bytes;
+				{
+					StageTimer timer(Timings::SEND);
+					bytes = m_socket->write(m_unsent + m_unsent_begin, m_unsent_end - m_unsent_begin);
+				}
+				if (bytes > 0) {
+					if (m_recorder != NULL)
+						m_recorder->record(RecordHeader::SENT, m_unsent + m_unsent_begin, bytes);
+					m_unsent_begin += bytes;
+					m_stats.bytes += bytes;
+					++m_stats.writes;
 				}
+				bool sent = m_unsent_begin == m_unsent_end;
+				if (sent)
+					Timings::instance().commandSent(m_unsent_time_stamp);
+				if (m_loop != NULL)
+					m_loop->wantWritable(m_socket->fd(), !sent);
+				return sent;
 			}
 	};
 
 	class ProtocolParser {
 		private:
-			std::vector<Protocol::Message> m_messages;
+			Protocol::ObjectStore m_objects;
 
-			void parseInitialization(Protocol::Message& msg, const char *stream) {
-				char msg_tag;
-				sscanf(stream, "%c %f %f %d %f %f %f %f %f ;",
-					&msg_tag,
-					&msg.initialization.dx,
-					&msg.initialization.dy,
-					&msg.initialization.time_limit,
-					&msg.initialization.min_sensor,
-					&msg.initialization.max_sensor,
-					&msg.initialization.max_speed,
-					&msg.initialization.max_turn,
-					&msg.initialization.max_hard_turn
-				);
-				msg.tag = static_cast<Protocol::MessageTag>(msg_tag);
-				std::cout << msg.initialization << std::endl;
+			bool parseInitialization(Protocol::Message& msg, Scanner& scan) {
+				return scan.readFloat(msg.initialization.dx)
+					&& scan.readFloat(msg.initialization.dy)
+					&& scan.readInt(msg.initialization.time_limit)
+					&& scan.readFloat(msg.initialization.min_sensor)
+					&& scan.readFloat(msg.initialization.max_sensor)
+					&& scan.readFloat(msg.initialization.max_speed)
+					&& scan.readFloat(msg.initialization.max_turn)
+					&& scan.readFloat(msg.initialization.max_hard_turn);
 			}
 
-			void parseTelemetry(Protocol::Message& msg, const char *stream) {
-				char msg_tag;
-				sscanf(stream, "%c %d %c%c %f %f %f %f %[-0123456789. bchm] ;",
-					&msg_tag,
-					&msg.telemetry.timestamp,
-					&msg.telemetry.vehicle_ctl[0], &msg.telemetry.vehicle_ctl[1],
-					&msg.telemetry.vehicle_x,
-					&msg.telemetry.vehicle_y,
-					&msg.telemetry.vehicle_dir,
-					&msg.telemetry.vehicle_speed,
-					msg.telemetry.string_objects // was &msg.telemetry.string_objects, wrong wrong!
-				);
-				msg.tag = static_cast<Protocol::MessageTag>(msg_tag);
+			bool parseTelemetry(Protocol::Message& msg, Scanner& scan) {
+				if (!(scan.readInt(msg.telemetry.timestamp)
+					&& scan.readChar(msg.telemetry.vehicle_ctl[0])
+					&& scan.readRawChar(msg.telemetry.vehicle_ctl[1])
+					&& scan.readFloat(msg.telemetry.vehicle_x)
+					&& scan.readFloat(msg.telemetry.vehicle_y)
+					&& scan.readFloat(msg.telemetry.vehicle_dir)
+					&& scan.readFloat(msg.telemetry.vehicle_speed)))
+					return false;
 
-				msg.telemetry.objects = new Protocol::MessageTelemetryStream::ObjectList();
-				msg.telemetry.objects->clear();
-				for (
-					char *ptr = strpbrk(msg.telemetry.string_objects, "bchm");
-					ptr != NULL;
-					ptr = strpbrk(ptr+1, "bchm")
-				) {
-					//printf("##### = %s\n", ptr);
-					Protocol::Object *obj = new Protocol::Object();
-					msg.telemetry.objects->push_back(obj);
-					char obj_tag;
-					switch (ptr[0]) {
+				m_objects.clear();
+				msg.telemetry.objects = &m_objects;
+				char obj_tag;
+				while (scan.readChar(obj_tag)) {
+					switch (obj_tag) {
 						case Protocol::TAG_BOULDER:
 						case Protocol::TAG_CRATER:
-						case Protocol::TAG_HOME:
-							sscanf(ptr, "%c %f %f %f ",
-								&obj_tag,
-								&obj->common.x,
-								&obj->common.y,
-								&obj->common.radius
-							);
-							obj->tag = static_cast<Protocol::ObjectTag>(obj_tag);
+						case Protocol::TAG_HOME: {
+							Protocol::ObjectCommon obj;
+							if (!(scan.readFloat(obj.x)
+								&& scan.readFloat(obj.y)
+								&& scan.readFloat(obj.radius)))
+								return false;
+							m_objects.circles(static_cast<Protocol::ObjectTag>(obj_tag))->push(obj);
 							break;
-						case Protocol::TAG_ENEMY:
-							sscanf(ptr, "%c %f %f %f %f ",
-								&obj_tag,
-								&obj->enemy.x,
-								&obj->enemy.y,
-								&obj->enemy.dir,
-								&obj->enemy.speed
-							);
-							obj->tag = static_cast<Protocol::ObjectTag>(obj_tag);
+						}
+						case Protocol::TAG_ENEMY: {
+							Protocol::ObjectMartian obj;
+							if (!(scan.readFloat(obj.x)
+								&& scan.readFloat(obj.y)
+								&& scan.readFloat(obj.dir)
+								&& scan.readFloat(obj.speed)))
+								return false;
+							m_objects.martians.push(obj);
 							break;
+						}
 						default:
-							std::cerr << "unknown object tag" << std::endl;
+							LOG_WARN("unknown object tag");
+							return false;
 					}
 				}
-				std::cout << msg.telemetry << std::endl;
+				return true;
 			}
 
-			void parseEvent(Protocol::Message& msg, const char *stream) {
-				char msg_tag;
-				sscanf(stream, "%c %d ;",
-					&msg_tag,
-					&msg.event.time_stamp
-				);
-				msg.tag = static_cast<Protocol::MessageTag>(msg_tag);
-				std::cout << msg.event << std::endl;
+			bool parseEvent(Protocol::Message& msg, Scanner& scan) {
+				return scan.readInt(msg.event.time_stamp);
 			}
 
-			void parseEndOfRun(Protocol::Message& msg, const char *stream) {
+			bool parseEndOfRun(Protocol::Message& msg, Scanner& scan) {
+				return scan.readInt(msg.end.time_stamp)
+					&& scan.readInt(msg.end.score);
+			}
+
+		public:
+			//
+			// Decodes a framed message in a single pass, without printing anything.
+			//
+			bool parseMessage(Protocol::Message& msg, const Slice& command) {
+				Scanner scan(command);
 				char msg_tag;
-				sscanf(stream, "%c %d %d ;",
-					&msg_tag,
-					&msg.end.time_stamp,
-					&msg.end.score
-				);
+				if (!scan.readChar(msg_tag))
+					return false;
 				msg.tag = static_cast<Protocol::MessageTag>(msg_tag);
-				std::cout << msg.end << std::endl;
+				switch (msg_tag) {
+					case Protocol::TAG_INITIALIZATION:
+						return parseInitialization(msg, scan);
+					case Protocol::TAG_TELEMETRY_STREAM:
+						msg.telemetry.objects = NULL;
+						return parseTelemetry(msg, scan);
+					case Protocol::TAG_CRASH:
+					case Protocol::TAG_KILLED_BY_MARTIAN:
+					case Protocol::TAG_FELL_INTO_CRATER:
+					case Protocol::TAG_SUCCESS:
+						return parseEvent(msg, scan);
+					case Protocol::TAG_END_OF_RUN:
+						return parseEndOfRun(msg, scan);
+					default:
+						LOG_WARN("unknown message tag");
+						return false;
+				}
 			}
 
-		public:
-			void parse(Protocol::Message& msg, const std::string& command) {
-				std::cout << "[RawMessage] " << command << std::endl;
-				const char *stream = command.c_str();
-				switch (stream[0]) {
+			//
+			// Decodes a framed message and traces it. False if it is malformed:
+			// `msg` may then be half filled and must not be applied.
+			//
+			bool parse(Protocol::Message& msg, const Slice& command) {
+				LOG_TRACE("[RawMessage] " << command);
+				if (!parseMessage(msg, command)) {
+					LOG_WARN("malformed message: " << command);
+					return false;
+				}
+				switch (msg.tag) {
 					case Protocol::TAG_INITIALIZATION:
-						parseInitialization(msg, stream);
+						LOG_TRACE(msg.initialization);
 						break;
 					case Protocol::TAG_TELEMETRY_STREAM:
-						parseTelemetry(msg, stream);
+						LOG_TRACE(msg.telemetry);
 						break;
+					case Protocol::TAG_CRASH:
 					case Protocol::TAG_KILLED_BY_MARTIAN:
 					case Protocol::TAG_FELL_INTO_CRATER:
 					case Protocol::TAG_SUCCESS:
-						parseEvent(msg, stream);
+						LOG_TRACE(msg.event);
 						break;
 					case Protocol::TAG_END_OF_RUN:
-						parseEndOfRun(msg, stream);
+						LOG_TRACE(msg.end);
 						break;
-					default:
-						std::cerr << "unknown message tag" << std::endl;
 				}
+				return true;
 			}
 	};
 
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "vector2.h"
+#include "geometry.h"
+
+namespace Movement {
+
+	// Circles a quadtree leaf holds before it is split in four.
+	const int QUADTREE_LEAF_CAPACITY = 8;
+	// Smallest side of a quadtree node (meters); leaves this small hold any number of circles.
+	const float QUADTREE_MIN_SIZE = 2.0f;
+
+	//
+	// Index over circles kept by the caller (a CircleSet, e.g. the world
+	// model's obstacles), as a quadtree of the square enclosing the map.
+	//
+	// Leaves only split where circles crowd, so the memory taken grows with
+	// the number of circles rather than with the area of the map: a sparse
+	// map of a few kilometers costs about as much as a small crowded one.
+	//
+	// A circle is listed in every leaf its bounding box overlaps, clamped to
+	// the map for the ones lying partly or wholly outside, so that queries
+	// clamped the same way still find them. Besides point, radius and segment
+	// queries, freeCells() splits the map into the largest squares clear of
+	// every circle, for searches that start coarse and refine where needed.
+	//
+	class Quadtree {
+		public:
+			// A square of the map (meters).
+			struct Cell {
+				float x0; // lower left corner
+				float y0;
+				float size;
+
+				Vector2 center() const {
+					return Vector2(x0 + size * 0.5f, y0 + size * 0.5f);
+				}
+			};
+
+			Quadtree() : m_origin(Vector2::ZERO), m_half(Vector2::ZERO), m_size(0.0f), m_free(-1), m_stamp_counter(0) {
+				// nop
+			}
+
+			//
+			// Covers a map of map_size meters centered at the origin, empty.
+			//
+			void reset(const Vector2& map_size) {
+				m_half = map_size * 0.5f;
+				m_size = std::max(map_size.x, map_size.y);
+				m_origin.set(-m_size * 0.5f, -m_size * 0.5f);
+				clear();
+			}
+			void clear() {
+				Node root = { m_origin.x, m_origin.y, m_size, -1, -1, 0 };
+				m_nodes.assign(1, root);
+				m_entries.clear();
+				m_free = -1;
+			}
+			// The square the tree covers, enclosing the map.
+			Cell root() const {
+				Cell root = { m_origin.x, m_origin.y, m_size };
+				return root;
+			}
+			// Nodes in the tree, none before reset().
+			int nodes() const {
+				return static_cast<int>(m_nodes.size());
+			}
+			// Memory held by the tree (bytes).
+			std::size_t bytes() const {
+				return m_nodes.capacity() * sizeof(Node) + m_entries.capacity() * sizeof(Entry)
+					+ m_stamps.capacity() * sizeof(unsigned) + (m_found.capacity() + m_stack.capacity()) * sizeof(int);
+			}
+
+			//
+			// Indexes circle `k` of `c`. It must not change afterwards, and later
+			// queries must be given the same circles (the arrays may have moved).
+			//
+			void insert(const CircleSet& c, int k) {
+				if (m_nodes.empty())
+					return;
+				if (m_stamps.size() <= static_cast<std::size_t>(k))
+					m_stamps.resize(std::max(static_cast<std::size_t>(k) + 1, m_stamps.size() * 2), 0);
+				add(c, 0, k);
+			}
+
+			//
+			// Collects, each once, the circles listed in the leaves overlapping the
+			// box from (x0, y0) to (x1, y1): every circle whose bounding box does,
+			// and possibly a few more.
+			//
+			void candidates(float x0, float y0, float x1, float y1, std::vector<int>& result) {
+				collect(x0, y0, x1, y1, NULL, NULL, 0.0f);
+				result.assign(m_found.begin(), m_found.end());
+			}
+
+			//
+			// First circle found that, grown by `grow`, contains `point`; -1 if none.
+			//
+			int firstContaining(const CircleSet& c, const Vector2& point, float grow) {
+				collect(point.x - grow, point.y - grow, point.x + grow, point.y + grow, NULL, NULL, 0.0f);
+				for (std::size_t n = 0; n < m_found.size(); ++n) {
+					int k = m_found[n];
+					float dx = c.x[k] - point.x, dy = c.y[k] - point.y, reach = c.r[k] + grow;
+					if (dx * dx + dy * dy <= reach * reach)
+						return k;
+				}
+				return -1;
+			}
+
+			//
+			// Collects the circles whose border is within `range` of `point`.
+			//
+			void queryRadius(const CircleSet& c, const Vector2& point, float range, std::vector<int>& result) {
+				result.clear();
+				collect(point.x - range, point.y - range, point.x + range, point.y + range, NULL, NULL, 0.0f);
+				for (std::size_t n = 0; n < m_found.size(); ++n) {
+					int k = m_found[n];
+					float dx = c.x[k] - point.x, dy = c.y[k] - point.y, reach = c.r[k] + range;
+					if (dx * dx + dy * dy <= reach * reach)
+						result.push_back(k);
+				}
+			}
+
+			//
+			// First circle found that, grown by `grow`, touches the segment from
+			// `a` to `b`, other than `ignore_a` and `ignore_b`; -1 if none.
+			//
+			int firstSegmentHit(const CircleSet& c, const Vector2& a, const Vector2& b, float grow, int ignore_a = -1, int ignore_b = -1) {
+				collect(std::min(a.x, b.x) - grow, std::min(a.y, b.y) - grow, std::max(a.x, b.x) + grow, std::max(a.y, b.y) + grow, &a, &b, grow);
+				for (std::size_t n = 0; n < m_found.size(); ++n) {
+					int k = m_found[n];
+					if (k == ignore_a || k == ignore_b)
+						continue;
+					float reach = c.r[k] + grow;
+					if (distanceSqToSegment(Vector2(c.x[k], c.y[k]), a, b) <= reach * reach)
+						return k;
+				}
+				return -1;
+			}
+
+			//
+			// Whether no circle, grown by `grow`, touches the square.
+			//
+			bool squareFree(const CircleSet& c, const Cell& square, float grow) {
+				collect(square.x0 - grow, square.y0 - grow, square.x0 + square.size + grow, square.y0 + square.size + grow, NULL, NULL, 0.0f);
+				for (std::size_t n = 0; n < m_found.size(); ++n) {
+					int k = m_found[n];
+					float px = std::min(std::max(c.x[k], square.x0), square.x0 + square.size);
+					float py = std::min(std::max(c.y[k], square.y0), square.y0 + square.size);
+					float dx = c.x[k] - px, dy = c.y[k] - py, reach = c.r[k] + grow;
+					if (dx * dx + dy * dy <= reach * reach)
+						return false;
+				}
+				return true;
+			}
+
+			//
+			// Covers the map with the largest squares, halving from the whole map
+			// down to `min_size` meters, that no circle grown by `grow` touches.
+			// What is left uncovered is blocked, or too cramped at that size.
+			// Squares along the edge of a map that is not square may stick out.
+			//
+			void freeCells(const CircleSet& c, float grow, float min_size, std::vector<Cell>& cells) {
+				cells.clear();
+				if (m_nodes.empty())
+					return;
+				subdivide(c, root(), grow, min_size, cells);
+			}
+
+			static float distanceSqToSegment(const Vector2& p, const Vector2& a, const Vector2& b) {
+				Vector2 ab = b - a;
+				float len_sq = ab.squaredLength();
+				float t = len_sq > 0.0f ? (p - a).dot(ab) / len_sq : 0.0f;
+				t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+				return (a + ab * t - p).squaredLength();
+			}
+
+		private:
+			struct Node {
+				float x0; // lower left corner
+				float y0;
+				float size;
+				int child; // first of the four children (SW, SE, NW, NE), or -1 for a leaf
+				int first; // first entry of a leaf, or -1
+				int count; // entries of a leaf
+			};
+			struct Entry {
+				int circle;
+				int next; // in the leaf, or in the free list
+			};
+
+			float clampX(float v) const {
+				return std::min(std::max(v, m_origin.x), m_origin.x + m_size);
+			}
+			float clampY(float v) const {
+				return std::min(std::max(v, m_origin.y), m_origin.y + m_size);
+			}
+			static bool overlaps(const Node& n, float x0, float y0, float x1, float y1) {
+				return x0 <= n.x0 + n.size && x1 >= n.x0 && y0 <= n.y0 + n.size && y1 >= n.y0;
+			}
+
+			// Lists circle k in the leaves under `node` its bounding box overlaps.
+			void add(const CircleSet& c, int node, int k) {
+				float x0 = clampX(c.x[k] - c.r[k]), x1 = clampX(c.x[k] + c.r[k]);
+				float y0 = clampY(c.y[k] - c.r[k]), y1 = clampY(c.y[k] + c.r[k]);
+				if (!overlaps(m_nodes[node], x0, y0, x1, y1))
+					return;
+				if (m_nodes[node].child != -1) {
+					int child = m_nodes[node].child;
+					for (int q = 0; q < 4; ++q)
+						add(c, child + q, k);
+					return;
+				}
+				int e = m_free;
+				if (e != -1) {
+					m_free = m_entries[e].next;
+				} else {
+					e = static_cast<int>(m_entries.size());
+					m_entries.push_back(Entry());
+				}
+				m_entries[e].circle = k;
+				m_entries[e].next = m_nodes[node].first;
+				m_nodes[node].first = e;
+				if (++m_nodes[node].count > QUADTREE_LEAF_CAPACITY && m_nodes[node].size * 0.5f >= QUADTREE_MIN_SIZE)
+					split(c, node);
+			}
+
+			// Turns a full leaf into four, handing its circles down.
+			void split(const CircleSet& c, int node) {
+				Node leaf = m_nodes[node];
+				float half = leaf.size * 0.5f;
+				int child = static_cast<int>(m_nodes.size());
+				for (int q = 0; q < 4; ++q) {
+					Node n = { leaf.x0 + (q & 1) * half, leaf.y0 + (q >> 1) * half, half, -1, -1, 0 };
+					m_nodes.push_back(n);
+				}
+				m_nodes[node].child = child;
+				m_nodes[node].first = -1;
+				m_nodes[node].count = 0;
+				for (int e = leaf.first; e != -1; ) {
+					int next = m_entries[e].next;
+					int k = m_entries[e].circle;
+					m_entries[e].next = m_free;
+					m_free = e;
+					for (int q = 0; q < 4; ++q)
+						add(c, child + q, k);
+					e = next;
+				}
+			}
+
+			//
+			// Gathers in m_found, once each, the circles listed in the leaves the
+			// box overlaps, clamped to the map. Given a segment, leaves inside the
+			// map that lie farther than `grow` from it are skipped.
+			//
+			void collect(float x0, float y0, float x1, float y1, const Vector2 *a, const Vector2 *b, float grow) {
+				m_found.clear();
+				if (m_nodes.empty())
+					return;
+				++m_stamp_counter;
+				x0 = clampX(x0);
+				x1 = clampX(x1);
+				y0 = clampY(y0);
+				y1 = clampY(y1);
+				m_stack.assign(1, 0);
+				while (!m_stack.empty()) {
+					const Node& n = m_nodes[m_stack.back()];
+					m_stack.pop_back();
+					if (!overlaps(n, x0, y0, x1, y1))
+						continue;
+					if (n.child != -1) {
+						for (int q = 0; q < 4; ++q)
+							m_stack.push_back(n.child + q);
+						continue;
+					}
+					if (n.first == -1)
+						continue;
+					if (a != NULL && !onBorder(n)) {
+						// Within half a diagonal (plus the growth) of the segment.
+						float reach = n.size * 0.7072f + grow;
+						Vector2 center(n.x0 + n.size * 0.5f, n.y0 + n.size * 0.5f);
+						if (distanceSqToSegment(center, *a, *b) > reach * reach)
+							continue;
+					}
+					for (int e = n.first; e != -1; e = m_entries[e].next) {
+						int k = m_entries[e].circle;
+						if (m_stamps[k] != m_stamp_counter) {
+							m_stamps[k] = m_stamp_counter;
+							m_found.push_back(k);
+						}
+					}
+				}
+			}
+			// Leaves along the edge of the map also hold the circles clamped into them.
+			bool onBorder(const Node& n) const {
+				return n.x0 <= m_origin.x || n.y0 <= m_origin.y
+					|| n.x0 + n.size >= m_origin.x + m_size || n.y0 + n.size >= m_origin.y + m_size;
+			}
+
+			void subdivide(const CircleSet& c, const Cell& square, float grow, float min_size, std::vector<Cell>& cells) {
+				if (square.x0 >= m_half.x || square.y0 >= m_half.y || square.x0 + square.size <= -m_half.x || square.y0 + square.size <= -m_half.y)
+					return; // off the map
+				if (squareFree(c, square, grow)) {
+					cells.push_back(square);
+					return;
+				}
+				float half = square.size * 0.5f;
+				if (half < min_size)
+					return;
+				for (int q = 0; q < 4; ++q) {
+					Cell quarter = { square.x0 + (q & 1) * half, square.y0 + (q >> 1) * half, half };
+					subdivide(c, quarter, grow, min_size, cells);
+				}
+			}
+
+			Vector2 m_origin; // lower left corner of the root
+			Vector2 m_half; // of the map size
+			float m_size; // side of the root
+			std::vector<Node> m_nodes; // the root first
+			std::vector<Entry> m_entries;
+			int m_free; // first unused entry, or -1
+			std::vector<unsigned> m_stamps; // per circle, so that circles in several leaves are found once
+			unsigned m_stamp_counter;
+			std::vector<int> m_found;
+			std::vector<int> m_stack;
+	};
+
+}
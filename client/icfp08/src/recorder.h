@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Bytes of log mapped up front; records past it are dropped and counted.
+const std::size_t RECORDER_CAPACITY = 64 << 20;
+const char RECORDER_MAGIC[8] = { 'I', 'C', 'F', 'P', 'R', 'E', 'C', '1' };
+
+//
+// Append-only binary log of a session, written into a memory-mapped file.
+//
+// Any thread may record(): space is claimed with an atomic add and the
+// record copied into it, with no lock nor system call, and nothing is
+// flushed until close(), which trims the file to what was written. Each
+// record is a RecordHeader with the monotonic time and the kind of what
+// follows, padded to 8 bytes.
+//
+struct RecordHeader {
+	enum Type {
+		END,		// zeroes past the last record
+		RECEIVED,	// a message from the server, without the terminator
+		SENT,		// bytes written to the server
+		TICK		// a TickRecord from the planner
+	};
+	int64_t nsec; // monotonic clock
+	uint16_t type;
+	uint16_t length; // of the payload
+	uint32_t reserved;
+};
+
+class Recorder {
+	public:
+		Recorder() : m_fd(-1), m_base(NULL), m_capacity(0), m_offset(0), m_dropped(0) {
+			// nop
+		}
+		~Recorder() {
+			close();
+		}
+
+		bool open(const char *path, std::size_t capacity = RECORDER_CAPACITY) {
+			m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+			if (m_fd == -1) {
+				perror("open");
+				return false;
+			}
+			if (ftruncate(m_fd, capacity) == -1) {
+				perror("ftruncate");
+				close();
+				return false;
+			}
+			void *base = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+			if (base == MAP_FAILED) {
+				perror("mmap");
+				close();
+				return false;
+			}
+			m_base = static_cast<char *>(base);
+			m_capacity = capacity;
+			memcpy(m_base, RECORDER_MAGIC, sizeof(RECORDER_MAGIC));
+			m_offset = sizeof(RECORDER_MAGIC);
+			return true;
+		}
+		// Only once every thread is done recording.
+		void close() {
+			if (m_base != NULL) {
+				munmap(m_base, m_capacity);
+				m_base = NULL;
+				if (ftruncate(m_fd, size()) == -1)
+					perror("ftruncate");
+			}
+			if (m_fd != -1) {
+				::close(m_fd);
+				m_fd = -1;
+			}
+		}
+		bool isOpen() const {
+			return m_base != NULL;
+		}
+
+		void record(RecordHeader::Type type, const void *data, std::size_t length) {
+			if (m_base == NULL)
+				return;
+			if (length > 0xffff)
+				length = 0xffff;
+			std::size_t size = (sizeof(RecordHeader) + length + 7) & ~static_cast<std::size_t>(7);
+			// Once full, the offset only grows past the end, where nothing is written.
+			std::size_t offset = __sync_fetch_and_add(&m_offset, size);
+			if (offset + size > m_capacity) {
+				__sync_fetch_and_add(&m_dropped, 1);
+				return;
+			}
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			RecordHeader header;
+			header.nsec = static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+			header.type = static_cast<uint16_t>(type);
+			header.length = static_cast<uint16_t>(length);
+			header.reserved = 0;
+			memcpy(m_base + offset + sizeof(header), data, length);
+			memcpy(m_base + offset, &header, sizeof(header));
+		}
+
+		// Bytes written so far, header included.
+		std::size_t size() const {
+			return m_offset < m_capacity ? m_offset : m_capacity;
+		}
+		unsigned long dropped() const {
+			return m_dropped;
+		}
+
+	private:
+		int m_fd;
+		char *m_base;
+		std::size_t m_capacity;
+		volatile std::size_t m_offset;
+		volatile unsigned long m_dropped;
+};
+
+//
+// Walks the records of a log written by a Recorder, mapped read-only.
+//
+class RecordReader {
+	public:
+		RecordReader() : m_fd(-1), m_base(NULL), m_size(0), m_offset(0) {
+			// nop
+		}
+		~RecordReader() {
+			if (m_base != NULL)
+				munmap(const_cast<char *>(m_base), m_size);
+			if (m_fd != -1)
+				::close(m_fd);
+		}
+
+		bool open(const char *path) {
+			m_fd = ::open(path, O_RDONLY);
+			if (m_fd == -1) {
+				perror("open");
+				return false;
+			}
+			struct stat info;
+			if (fstat(m_fd, &info) == -1 || info.st_size < static_cast<off_t>(sizeof(RECORDER_MAGIC))) {
+				fprintf(stderr, "%s: not a log\n", path);
+				return false;
+			}
+			void *base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+			if (base == MAP_FAILED) {
+				perror("mmap");
+				return false;
+			}
+			m_base = static_cast<const char *>(base);
+			m_size = info.st_size;
+			if (memcmp(m_base, RECORDER_MAGIC, sizeof(RECORDER_MAGIC)) != 0) {
+				fprintf(stderr, "%s: not a log\n", path);
+				return false;
+			}
+			rewind();
+			return true;
+		}
+		void rewind() {
+			m_offset = sizeof(RECORDER_MAGIC);
+		}
+
+		// The next record, whose payload stays valid as long as the reader; false at the end.
+		bool next(RecordHeader& header, const char *&payload) {
+			if (m_offset + sizeof(RecordHeader) > m_size)
+				return false;
+			memcpy(&header, m_base + m_offset, sizeof(header));
+			std::size_t size = (sizeof(RecordHeader) + header.length + 7) & ~static_cast<std::size_t>(7);
+			if (header.type == RecordHeader::END || m_offset + size > m_size)
+				return false;
+			payload = m_base + m_offset + sizeof(header);
+			m_offset += size;
+			return true;
+		}
+
+	private:
+		int m_fd;
+		const char *m_base;
+		std::size_t m_size;
+		std::size_t m_offset;
+};
@@ -0,0 +1,418 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <ctime>
+#include <limits>
+#include "vector2.h"
+#include "worldmodel.h"
+#include "quadtree.h"
+#include "occupancy.h"
+#include "indexedheap.h"
+#include "gridplanner.h"
+
+namespace Movement {
+
+	// Smallest free square of the coarse region graph (meters).
+	const float REGION_MIN_SIZE = 1.0f;
+	// Cost to the goal of the regions cut off from it.
+	const float REGION_UNREACHABLE = std::numeric_limits<float>::max();
+	// How far down the coarse route the fine search goes, at least (meters).
+	const float FINE_HORIZON = 50.0f;
+	// How far around the regions of the coarse route the fine search may go (meters).
+	const float CORRIDOR_MARGIN = 4.0f;
+	// A new coarse route replaces the one followed only if at most this much of its length.
+	const float ROUTE_SWITCH_RATIO = 0.8f;
+
+	//
+	// Two-level planner: a coarse route over the free regions of the world
+	// model, then a fine GridPlanner search confined to the corridor the
+	// route's regions make.
+	//
+	// The regions are the largest squares of the world model's quadtree clear
+	// of every obstacle (Quadtree::freeCells()), linked where they share a
+	// side. A single backward Dijkstra from the goal's region gives every
+	// region its next one towards the goal, so the coarse route from wherever
+	// the rover is only takes following those. All of it is kept until the
+	// world model learns new obstacles: runs after the first one of a trial,
+	// on a map already explored, mostly reuse it as is.
+	//
+	// Each new obstacle changes the costs, and two routes around a wall can
+	// come out the cheaper in turn from one tick to the next. The sides the
+	// route followed leaves its regions by are kept, and it is followed as
+	// long as it stays clear, unless the one just found is shorter than
+	// ROUTE_SWITCH_RATIO of it.
+	//
+	// A fine search that cannot reach the goal inside the corridor, whose
+	// regions cannot go through passages narrower than REGION_MIN_SIZE, is
+	// run again over the whole grid.
+	//
+	class RegionPlanner {
+		public:
+			struct Stats {
+				int regions; // in the graph
+				int links; // between regions, both ways
+				int route; // regions of the last coarse route
+				int switches; // to a new coarse route, away from a clear one
+				int builds; // of the graph
+				int reuses; // ticks planning on an already built graph
+				int fallbacks; // fine searches run again outside the corridor
+				long build_usec; // taken by the last build
+			};
+
+			RegionPlanner() : m_world_size(0), m_width(0), m_height(0), m_inflation(-1.0f), m_goal(Vector2::ZERO), m_goal_region(-1) {
+				m_stats.regions = m_stats.links = m_stats.route = m_stats.switches = 0;
+				m_stats.builds = m_stats.reuses = m_stats.fallbacks = 0;
+				m_stats.build_usec = 0;
+			}
+
+			void setBudget(long usec) {
+				m_fine.setBudget(usec);
+			}
+			void setAnyAngle(bool any_angle) {
+				m_fine.setAnyAngle(any_angle);
+			}
+			// Forgets the region graph, the next plan() builds it again.
+			void invalidate() {
+				m_width = m_height = 0;
+				m_kept.clear();
+			}
+			const Stats& stats() const {
+				return m_stats;
+			}
+			// Waypoints of the last plan, from start to goal.
+			const std::vector<Vector2>& path() const {
+				return m_path;
+			}
+			const std::vector<Quadtree::Cell>& regions() const {
+				return m_regions;
+			}
+			// Regions of the last coarse route, from the rover's to the goal's.
+			const std::vector<int>& route() const {
+				return m_route;
+			}
+
+			GridPlanner::Result plan(WorldModel& world, const OccupancyGrid& grid, const Vector2& from, const Vector2& to, float inflation) {
+				m_route.clear();
+				m_path.clear();
+				if (grid.empty())
+					return GridPlanner::NO_PATH;
+				if (world.size() != m_world_size || grid.width() != m_width || grid.height() != m_height
+					|| inflation != m_inflation || to != m_goal)
+				{
+					build(world, grid, to, inflation);
+				} else {
+					++m_stats.reuses;
+				}
+
+				int region = locate(from);
+				if (region == -1)
+					region = nearest(from);
+				for (int guard = 0; region != -1 && m_cost[region] != REGION_UNREACHABLE && guard < static_cast<int>(m_regions.size()); ++guard) {
+					m_route.push_back(region);
+					if (region == m_goal_region)
+						break;
+					region = m_next[region];
+				}
+				m_stats.route = static_cast<int>(m_route.size());
+				if (m_route.empty() || m_route.back() != m_goal_region) {
+					++m_stats.fallbacks;
+					GridPlanner::Result result = m_fine.plan(grid, from, to);
+					m_path = m_fine.path();
+					return result;
+				}
+
+				// The sides the route leaves its regions by, then the goal, or those
+				// of the route followed until now.
+				m_sides.clear();
+				for (std::size_t k = 0; k + 1 < m_route.size(); ++k)
+					m_sides.push_back(m_exit[m_route[k]]);
+				m_sides.push_back(to);
+				keepRoute(world, from, to, inflation);
+
+				// Fine search across the first legs of the route only, up to the
+				// side it leaves the last of them by; straight on from side to side after.
+				float along = 0.0f;
+				Vector2 previous = from;
+				std::size_t last = 0;
+				while (last + 1 < m_sides.size() && along < FINE_HORIZON) {
+					along += (m_sides[last] - previous).length();
+					previous = m_sides[last];
+					++last;
+				}
+				Vector2 subgoal = m_sides[last - 1];
+				markCorridor(grid, from, last);
+				GridPlanner::Result result = m_fine.plan(grid, from, subgoal, &m_corridor);
+				if (result != GridPlanner::FOUND_PATH) {
+					++m_stats.fallbacks;
+					m_kept.clear();
+					result = m_fine.plan(grid, from, to);
+					m_path = m_fine.path();
+					return result;
+				}
+				m_path = m_fine.path();
+				for (std::size_t k = last; k < m_sides.size(); ++k)
+					m_path.push_back(m_sides[k]);
+				return GridPlanner::FOUND_PATH;
+			}
+
+		private:
+			// Node of the tree locating regions, mirroring the subdivision freeCells() made.
+			struct Node {
+				int child; // first of the four children (SW, SE, NW, NE), or -1
+				int region; // if this square is a region, or -1
+			};
+
+			void build(WorldModel& world, const OccupancyGrid& grid, const Vector2& to, float inflation) {
+				struct timespec started, finished;
+				clock_gettime(CLOCK_MONOTONIC, &started);
+				m_world_size = world.size();
+				m_width = grid.width();
+				m_height = grid.height();
+				m_inflation = inflation;
+				m_goal = to;
+				m_root = world.bounds();
+				world.freeCells(inflation, REGION_MIN_SIZE, m_regions);
+				index();
+				link();
+				m_goal_region = locate(to);
+				if (m_goal_region == -1)
+					m_goal_region = nearest(to);
+				costsToGoal();
+				clock_gettime(CLOCK_MONOTONIC, &finished);
+				m_stats.build_usec = (finished.tv_sec - started.tv_sec) * 1000000 + (finished.tv_nsec - started.tv_nsec) / 1000;
+				++m_stats.builds;
+				m_stats.regions = static_cast<int>(m_regions.size());
+				m_stats.links = static_cast<int>(m_links.size());
+			}
+
+			// Every region is a square of the halving of the root, so it has a node of its own.
+			void index() {
+				Node root = { -1, -1 };
+				m_nodes.assign(1, root);
+				for (std::size_t r = 0; r < m_regions.size(); ++r) {
+					Vector2 center = m_regions[r].center();
+					int node = 0;
+					float x0 = m_root.x0, y0 = m_root.y0, size = m_root.size;
+					while (size > m_regions[r].size * 1.5f) {
+						if (m_nodes[node].child == -1) {
+							m_nodes[node].child = static_cast<int>(m_nodes.size());
+							for (int q = 0; q < 4; ++q)
+								m_nodes.push_back(root);
+						}
+						size *= 0.5f;
+						int q = (center.x >= x0 + size ? 1 : 0) | (center.y >= y0 + size ? 2 : 0);
+						x0 += (q & 1) * size;
+						y0 += (q >> 1) * size;
+						node = m_nodes[node].child + q;
+					}
+					m_nodes[node].region = static_cast<int>(r);
+				}
+			}
+
+			//
+			// Region containing the point, or -1. `extent` is the square found:
+			// the region, or the largest one around the point without any.
+			//
+			int locate(const Vector2& p, Quadtree::Cell *extent = NULL) const {
+				Quadtree::Cell square = m_root;
+				if (m_nodes.empty() || p.x < square.x0 || p.y < square.y0 || p.x >= square.x0 + square.size || p.y >= square.y0 + square.size) {
+					if (extent != NULL)
+						*extent = square;
+					return -1;
+				}
+				int node = 0;
+				while (m_nodes[node].region == -1 && m_nodes[node].child != -1) {
+					square.size *= 0.5f;
+					int q = (p.x >= square.x0 + square.size ? 1 : 0) | (p.y >= square.y0 + square.size ? 2 : 0);
+					square.x0 += (q & 1) * square.size;
+					square.y0 += (q >> 1) * square.size;
+					node = m_nodes[node].child + q;
+				}
+				if (extent != NULL)
+					*extent = square;
+				return m_nodes[node].region;
+			}
+
+			// Region whose center is closest to the point, for points in none; -1 if there are none.
+			int nearest(const Vector2& p) const {
+				int best = -1;
+				float best_sq = std::numeric_limits<float>::max();
+				for (std::size_t r = 0; r < m_regions.size(); ++r) {
+					float d = (m_regions[r].center() - p).squaredLength();
+					if (d < best_sq) {
+						best_sq = d;
+						best = static_cast<int>(r);
+					}
+				}
+				return best;
+			}
+
+			//
+			// Links every region to those across its sides, walking each side
+			// one neighbor (or one square without any) at a time.
+			//
+			void link() {
+				m_first_link.assign(m_regions.size() + 1, 0);
+				m_links.clear();
+				m_portals.clear();
+				float step = REGION_MIN_SIZE * 0.25f; // into the neighbor, off the corners
+				for (std::size_t r = 0; r < m_regions.size(); ++r) {
+					m_first_link[r] = static_cast<int>(m_links.size());
+					const Quadtree::Cell& cell = m_regions[r];
+					for (int side = 0; side < 4; ++side) {
+						bool vertical = side < 2; // the west and east sides run along y
+						float across = side == 0 ? cell.x0 - step : side == 1 ? cell.x0 + cell.size + step
+							: side == 2 ? cell.y0 - step : cell.y0 + cell.size + step;
+						float start = vertical ? cell.y0 : cell.x0;
+						for (float t = start + step; t < start + cell.size; ) {
+							Vector2 p = vertical ? Vector2(across, t) : Vector2(t, across);
+							Quadtree::Cell found;
+							int n = locate(p, &found);
+							if (n != -1) {
+								m_links.push_back(n);
+								m_portals.push_back(portal(cell, m_regions[n]));
+							}
+							t = (vertical ? found.y0 : found.x0) + found.size + step;
+						}
+					}
+				}
+				m_first_link[m_regions.size()] = static_cast<int>(m_links.size());
+			}
+
+			//
+			// Cost to the goal from every region, the next region on the way and
+			// the point it is left by: from the middle of the side it leaves by,
+			// straight from side to side, so that large regions are not costed
+			// as if crossed through their center.
+			//
+			void costsToGoal() {
+				std::size_t count = m_regions.size();
+				m_cost.assign(count, REGION_UNREACHABLE);
+				m_next.assign(count, -1);
+				m_exit.assign(count, m_goal);
+				if (m_goal_region == -1)
+					return;
+				m_open.resize(count);
+				m_cost[m_goal_region] = 0.0f;
+				m_open.push(m_goal_region, 0.0f);
+				while (!m_open.empty()) {
+					int u = m_open.pop();
+					// Links go both ways, through the same side.
+					for (int l = m_first_link[u]; l < m_first_link[u + 1]; ++l) {
+						int v = m_links[l];
+						float cost = m_cost[u] + (m_portals[l] - m_exit[u]).length();
+						if (cost < m_cost[v]) {
+							m_cost[v] = cost;
+							m_next[v] = u;
+							m_exit[v] = m_portals[l];
+							m_open.push(v, cost);
+						}
+					}
+				}
+			}
+
+			// Middle of the side squares p and q share.
+			static Vector2 portal(const Quadtree::Cell& p, const Quadtree::Cell& q) {
+				float x0 = std::max(p.x0, q.x0), x1 = std::min(p.x0 + p.size, q.x0 + q.size);
+				float y0 = std::max(p.y0, q.y0), y1 = std::min(p.y0 + p.size, q.y0 + q.size);
+				return Vector2((x0 + x1) * 0.5f, (y0 + y1) * 0.5f);
+			}
+
+			//
+			// Puts back in m_sides the route followed until now, less the sides
+			// behind the rover, if every leg of it is still clear and the new
+			// one is not clearly shorter.
+			//
+			void keepRoute(WorldModel& world, const Vector2& from, const Vector2& to, float inflation) {
+				std::size_t passed = 0;
+				while (passed + 1 < m_kept.size() && (m_kept[passed + 1] - from).length() <= (m_kept[passed + 1] - m_kept[passed]).length())
+					++passed;
+				m_kept.erase(m_kept.begin(), m_kept.begin() + passed);
+				// The rover itself may be closer than `inflation` to an obstacle.
+				bool clear = !m_kept.empty() && m_kept.back() == to;
+				for (std::size_t k = 0; clear && k < m_kept.size(); ++k)
+					clear = !world.segmentIntersects(k == 0 ? from : m_kept[k - 1], m_kept[k], k == 0 ? 0.0f : inflation);
+				if (clear && length(from, m_sides) >= length(from, m_kept) * ROUTE_SWITCH_RATIO) {
+					m_sides = m_kept;
+					return;
+				}
+				if (clear && m_sides != m_kept)
+					++m_stats.switches;
+				m_kept = m_sides;
+			}
+
+			static float length(const Vector2& from, const std::vector<Vector2>& sides) {
+				float total = 0.0f;
+				Vector2 previous = from;
+				for (std::size_t k = 0; k < sides.size(); ++k) {
+					total += (sides[k] - previous).length();
+					previous = sides[k];
+				}
+				return total;
+			}
+
+			//
+			// Marks the grid cells around the first `count` legs of the route: the
+			// region each crosses, or where it lies in none the box around it,
+			// grown by CORRIDOR_MARGIN.
+			//
+			void markCorridor(const OccupancyGrid& grid, const Vector2& from, std::size_t count) {
+				std::size_t cells = static_cast<std::size_t>(grid.width()) * grid.height();
+				if (m_corridor.marks.size() != cells) {
+					m_corridor.marks.assign(cells, 0);
+					m_corridor.stamp = 0;
+				}
+				if (++m_corridor.stamp == 0) {
+					std::fill(m_corridor.marks.begin(), m_corridor.marks.end(), 0);
+					m_corridor.stamp = 1;
+				}
+				for (std::size_t k = 0; k < count; ++k) {
+					const Vector2& a = k == 0 ? from : m_sides[k - 1];
+					const Vector2& b = m_sides[k];
+					int region = locate((a + b) * 0.5f);
+					float x0 = std::min(a.x, b.x), x1 = std::max(a.x, b.x);
+					float y0 = std::min(a.y, b.y), y1 = std::max(a.y, b.y);
+					if (region != -1) {
+						const Quadtree::Cell& cell = m_regions[region];
+						x0 = std::min(x0, cell.x0);
+						x1 = std::max(x1, cell.x0 + cell.size);
+						y0 = std::min(y0, cell.y0);
+						y1 = std::max(y1, cell.y0 + cell.size);
+					}
+					int i0 = grid.cellX(x0 - CORRIDOR_MARGIN), i1 = grid.cellX(x1 + CORRIDOR_MARGIN);
+					int j0 = grid.cellY(y0 - CORRIDOR_MARGIN), j1 = grid.cellY(y1 + CORRIDOR_MARGIN);
+					for (int j = j0; j <= j1; ++j)
+						for (int i = i0; i <= i1; ++i)
+							m_corridor.marks[j * grid.width() + i] = m_corridor.stamp;
+				}
+			}
+
+			GridPlanner m_fine;
+			Corridor m_corridor;
+			// What the graph was built for.
+			std::size_t m_world_size;
+			int m_width;
+			int m_height;
+			float m_inflation;
+			Vector2 m_goal;
+			// The graph.
+			Quadtree::Cell m_root; // halved into the regions
+			std::vector<Quadtree::Cell> m_regions;
+			std::vector<Node> m_nodes;
+			std::vector<int> m_first_link; // per region, into m_links, plus the end
+			std::vector<int> m_links;
+			std::vector<Vector2> m_portals; // per link, middle of the side shared
+			int m_goal_region;
+			std::vector<float> m_cost; // to the goal's region
+			std::vector<int> m_next; // towards the goal's region
+			std::vector<Vector2> m_exit; // where the route leaves each region
+			IndexedHeap<float> m_open;
+			std::vector<int> m_route;
+			std::vector<Vector2> m_sides; // the route's, from the rover's region to the goal
+			std::vector<Vector2> m_kept; // those of the route followed
+			std::vector<Vector2> m_path;
+			Stats m_stats;
+	};
+
+}
@@ -0,0 +1,162 @@
+#include <vector>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include "recorder.h"
+#include "protocol.h"
+#include "movement.h"
+#include "pathfind.h"
+
+using namespace Communication;
+using namespace Movement;
+
+//
+// Feeds a log written by the client back through the ProtocolParser and
+// ControllerState::update(), as fast as they go.
+//
+// Every recorded planner tick is replayed on the messages received up to
+// the telemetry it planned on, predicting the vehicle as far ahead as it
+// did, and its decision is compared with the recorded one bit for bit.
+// With -p only the messages are replayed, to time the parser. A session
+// played with a world file replays with -w and a copy of that file as it
+// was when the session started.
+//
+
+// Generous enough for every search to finish, as they must have to be reproduced.
+const long REPLAY_PLANNING_BUDGET = 1000000; // microseconds
+
+struct Message {
+	const char *data;
+	std::size_t size;
+};
+
+// The replayed controller's commands go nowhere, its decisions are compared instead.
+static bool discard(void *, int, int, int, int) {
+	return true;
+}
+
+static double secondsSince(const struct timespec& since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since.tv_sec) + (now.tv_nsec - since.tv_nsec) * 1e-9;
+}
+
+static void printTick(const char *label, const TickRecord& tick) {
+	printf("  %s: move %d -> %d, turn %d -> %d, plan %d, path %.9g m, cost %.9g\n", label,
+		tick.move_before, tick.move_after, tick.turn_before, tick.turn_after,
+		tick.plan, tick.path_length, tick.local_cost);
+}
+
+static void usage() {
+	fprintf(stderr, "usage: icfpReplay [-p] [-v] [-b budget_usec] [-w world_file] <log>\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	bool parse_only = false;
+	bool verbose = false;
+	long budget = REPLAY_PLANNING_BUDGET;
+	const char *world_file = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "pvb:w:")) != -1) {
+		switch (opt) {
+			case 'p': parse_only = true; break;
+			case 'v': verbose = true; break;
+			case 'b': budget = atol(optarg); break;
+			case 'w': world_file = optarg; break;
+			default: usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+
+	RecordReader reader;
+	if (!reader.open(argv[optind]))
+		return 1;
+	std::vector<Message> messages;
+	std::vector<TickRecord> ticks;
+	std::size_t bytes = 0, sent = 0;
+	RecordHeader header;
+	const char *payload;
+	while (reader.next(header, payload)) {
+		if (header.type == RecordHeader::RECEIVED) {
+			Message message = { payload, header.length };
+			messages.push_back(message);
+			bytes += header.length;
+		} else if (header.type == RecordHeader::TICK && header.length == sizeof(TickRecord)) {
+			TickRecord tick;
+			memcpy(&tick, payload, sizeof(tick));
+			ticks.push_back(tick);
+		} else if (header.type == RecordHeader::SENT) {
+			++sent;
+		}
+	}
+	printf("%zu messages (%zu bytes) received, %zu commands sent, %zu ticks\n", messages.size(), bytes, sent, ticks.size());
+	if (verbose)
+		Logger::instance().start(stdout);
+
+	ProtocolParser parser;
+	Protocol::Message message;
+	message.tag = Protocol::TAG_INITIALIZATION;
+	Controller controller(discard, NULL);
+	ControllerState& state = controller.state();
+	state.setRealTime(false);
+	WorldStore world_store;
+	if (world_file != NULL) {
+		if (!world_store.open(world_file, true))
+			return 1;
+		state.setWorldStore(&world_store);
+	}
+	struct timespec started;
+	clock_gettime(CLOCK_MONOTONIC, &started);
+
+	if (parse_only) {
+		int malformed = 0;
+		for (std::size_t i = 0; i < messages.size(); ++i) {
+			if (parser.parseMessage(message, Slice(messages[i].data, messages[i].size)))
+				state.update(message);
+			else
+				++malformed;
+			message.clear();
+		}
+		double seconds = secondsSince(started);
+		printf("parsed in %.3f s: %.0f messages/s, %.1f MB/s, %d malformed\n", seconds,
+			messages.size() / seconds, bytes / seconds / 1e6, malformed);
+		return 0;
+	}
+
+	PathFind path_finder(&controller, false);
+	path_finder.setPlanningBudget(budget);
+	std::size_t next = 0;
+	int telemetry = 0, mismatches = 0;
+	for (std::size_t t = 0; t < ticks.size(); ++t) {
+		const TickRecord& recorded = ticks[t];
+		// What had arrived when the tick took its snapshot; later messages wait.
+		while (telemetry < recorded.telemetry_count && next < messages.size()) {
+			if (parser.parseMessage(message, Slice(messages[next].data, messages[next].size))) {
+				state.update(message);
+				if (message.tag == Protocol::TAG_TELEMETRY_STREAM)
+					++telemetry;
+			}
+			message.clear();
+			++next;
+		}
+		state.replayElapsed(recorded.elapsed);
+		path_finder.adjustCourse();
+		const TickRecord& replayed = path_finder.lastTick();
+		if (memcmp(&recorded, &replayed, sizeof(TickRecord)) != 0) {
+			if (++mismatches <= 5) {
+				printf("tick %zu (telemetry %d) differs\n", t, recorded.telemetry_count);
+				printTick("recorded", recorded);
+				printTick("replayed", replayed);
+			}
+		}
+	}
+	double seconds = secondsSince(started);
+	printf("replayed %zu ticks in %.3f s (%.0f ticks/s): %d differ\n", ticks.size(), seconds,
+		seconds > 0.0 ? ticks.size() / seconds : 0.0, mismatches);
+	return mismatches == 0 ? 0 : 2;
+}
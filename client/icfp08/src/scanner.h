@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include "framer.h"
+
+namespace Communication {
+
+	//
+	// Single-pass tokenizer over a framed message.
+	//
+	// Numbers are converted by hand, so the result does not depend on the
+	// C locale and nothing is copied out of the receive buffer.
+	//
+	class Scanner {
+		private:
+			const char *m_pos;
+			const char *m_end;
+		public:
+			Scanner(const Slice& slice) : m_pos(slice.begin()), m_end(slice.end()) {
+				// nop
+			}
+			bool atEnd() {
+				skipBlanks();
+				return m_pos == m_end;
+			}
+			char peek() {
+				skipBlanks();
+				return m_pos < m_end ? *m_pos : '\0';
+			}
+			bool readChar(char& out) {
+				skipBlanks();
+				if (m_pos == m_end)
+					return false;
+				out = *m_pos++;
+				return true;
+			}
+			// Reads a single character, blanks included (e.g. the 2nd char of vehicle-ctl).
+			bool readRawChar(char& out) {
+				if (m_pos == m_end)
+					return false;
+				out = *m_pos++;
+				return true;
+			}
+			bool readInt(int& out) {
+				skipBlanks();
+				const char *p = m_pos;
+				bool negative = false;
+				if (p < m_end && (*p == '-' || *p == '+'))
+					negative = *p++ == '-';
+				if (p == m_end || !isDigit(*p))
+					return false;
+				long value = 0;
+				while (p < m_end && isDigit(*p))
+					value = value * 10 + (*p++ - '0');
+				out = static_cast<int>(negative ? -value : value);
+				m_pos = p;
+				return true;
+			}
+			bool readFloat(float& out) {
+				skipBlanks();
+				const char *p = m_pos;
+				bool negative = false;
+				if (p < m_end && (*p == '-' || *p == '+'))
+					negative = *p++ == '-';
+				unsigned long long mantissa = 0;
+				int exponent = 0;
+				bool any = false;
+				for (; p < m_end && isDigit(*p); ++p, any = true) {
+					if (mantissa < MANTISSA_LIMIT)
+						mantissa = mantissa * 10 + (*p - '0');
+					else
+						++exponent; // digits beyond double precision only scale
+				}
+				if (p < m_end && *p == '.') {
+					for (++p; p < m_end && isDigit(*p); ++p, any = true) {
+						if (mantissa < MANTISSA_LIMIT) {
+							mantissa = mantissa * 10 + (*p - '0');
+							--exponent;
+						}
+					}
+				}
+				if (!any)
+					return false;
+				if (p < m_end && (*p == 'e' || *p == 'E')) {
+					const char *q = p + 1;
+					bool exp_negative = false;
+					if (q < m_end && (*q == '-' || *q == '+'))
+						exp_negative = *q++ == '-';
+					if (q < m_end && isDigit(*q)) {
+						int value = 0;
+						for (; q < m_end && isDigit(*q); ++q)
+							if (value < 1000)
+								value = value * 10 + (*q - '0');
+						exponent += exp_negative ? -value : value;
+						p = q;
+					}
+				}
+				double value = static_cast<double>(mantissa);
+				value = exponent < 0 ? value / powerOf10(-exponent) : value * powerOf10(exponent);
+				out = static_cast<float>(negative ? -value : value);
+				m_pos = p;
+				return true;
+			}
+		private:
+			static const unsigned long long MANTISSA_LIMIT = 100000000000000000ULL; // 1e17
+
+			void skipBlanks() {
+				while (m_pos < m_end && (*m_pos == ' ' || *m_pos == '\t' || *m_pos == '\n' || *m_pos == '\r'))
+					++m_pos;
+			}
+			static bool isDigit(char c) {
+				return c >= '0' && c <= '9';
+			}
+			static double powerOf10(int n) {
+				static const double table[] = {
+					1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+					1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+				};
+				double result = 1.0;
+				for (; n > 22; n -= 22)
+					result *= table[22];
+				return result * table[n];
+			}
+	};
+
+}
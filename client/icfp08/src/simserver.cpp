@@ -0,0 +1,242 @@
+#include <string>
+#include <iostream>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "simulator.h"
+
+using namespace Simulation;
+using Communication::Protocol;
+
+//
+// Stand-in for the contest server: plays the runs of a .wrld map to one
+// controller at a time over TCP on localhost.
+//
+// Simulated time runs `speedup` times faster than the wall clock, so a
+// controller that keeps up can be evaluated on many runs a minute.
+//
+
+struct Options {
+	int port;
+	double speedup;
+	int runs; // per trial, 0 for all of the map's
+	int trials; // 0 for no limit
+	unsigned seed;
+	const char *map;
+};
+
+static long long nowUsec() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<long long>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+static bool sendAll(int fd, const std::string& text) {
+	std::size_t sent = 0;
+	while (sent < text.size()) {
+		ssize_t bytes = ::send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("send");
+			return false;
+		}
+		sent += bytes;
+	}
+	return true;
+}
+
+//
+// Waits for commands until the wall clock reaches `deadline`, applying them
+// as they arrive. A command is only whole once its `;` is in, so a partial
+// one is kept in `pending` for the next call. Commands the contest server
+// would drop are dropped too, and told about. False once the controller has
+// gone away.
+//
+static bool receiveUntil(int fd, long long deadline, Simulator& sim, std::string& pending) {
+	while (true) {
+		long long remaining = deadline - nowUsec();
+		struct pollfd ready = { fd, POLLIN, 0 };
+		int count = ::poll(&ready, 1, remaining > 0 ? static_cast<int>((remaining + 999) / 1000) : 0);
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return false;
+		}
+		if (count == 0)
+			return true;
+		char buffer[256];
+		ssize_t bytes = ::recv(fd, buffer, sizeof(buffer), 0);
+		if (bytes <= 0)
+			return bytes == -1 && errno == EINTR;
+		pending.append(buffer, bytes);
+		std::size_t begin = 0;
+		for (std::size_t end; (end = pending.find(';', begin)) != std::string::npos; begin = end + 1) {
+			if (!sim.command(pending.data() + begin, end - begin))
+				std::cerr << "invalid command \"" << pending.substr(begin, end - begin) << ";\" dropped" << std::endl;
+		}
+		pending.erase(0, begin);
+		if (remaining <= 0)
+			return true;
+	}
+}
+
+static void appendCircles(std::string& out, char tag, const Protocol::CircleArray& circles) {
+	char text[64];
+	for (std::size_t i = 0; i < circles.size(); ++i) {
+		snprintf(text, sizeof(text), " %c %.3f %.3f %.3f", tag, circles.x[i], circles.y[i], circles.radius[i]);
+		out += text;
+	}
+}
+
+// Appends a message in the protocol's text to the std::string behind `context`.
+static void encode(void *context, const Protocol::Message& message) {
+	std::string& out = *static_cast<std::string *>(context);
+	char text[160];
+	switch (message.tag) {
+		case Protocol::TAG_INITIALIZATION: {
+			const Protocol::MessageInitialization& init = message.initialization;
+			snprintf(text, sizeof(text), "I %.3f %.3f %d %.3f %.3f %.3f %.3f %.3f ;",
+				init.dx, init.dy, init.time_limit, init.min_sensor, init.max_sensor,
+				init.max_speed, init.max_turn, init.max_hard_turn);
+			out += text;
+			break;
+		}
+		case Protocol::TAG_TELEMETRY_STREAM: {
+			const Protocol::MessageTelemetryStream& telemetry = message.telemetry;
+			snprintf(text, sizeof(text), "T %d %c%c %.3f %.3f %.1f %.3f", telemetry.timestamp,
+				telemetry.vehicle_ctl[0], telemetry.vehicle_ctl[1], telemetry.vehicle_x, telemetry.vehicle_y,
+				telemetry.vehicle_dir, telemetry.vehicle_speed);
+			out += text;
+			const Protocol::ObjectStore& objects = *telemetry.objects;
+			appendCircles(out, Protocol::TAG_BOULDER, objects.boulders);
+			appendCircles(out, Protocol::TAG_CRATER, objects.craters);
+			appendCircles(out, Protocol::TAG_HOME, objects.homes);
+			for (std::size_t i = 0; i < objects.martians.size(); ++i) {
+				snprintf(text, sizeof(text), " m %.3f %.3f %.1f %.3f", objects.martians.x[i], objects.martians.y[i],
+					objects.martians.dir[i], objects.martians.speed[i]);
+				out += text;
+			}
+			out += " ;";
+			break;
+		}
+		case Protocol::TAG_END_OF_RUN:
+			snprintf(text, sizeof(text), "E %d %d ;", message.end.time_stamp, message.end.score);
+			out += text;
+			break;
+		default:
+			snprintf(text, sizeof(text), "%c %d ;", static_cast<char>(message.tag), message.event.time_stamp);
+			out += text;
+			break;
+	}
+}
+
+// Plays one trial to a connected controller.
+static void serve(int fd, const Options& options, const WorldMap& map, unsigned trial) {
+	std::string out;
+	Simulator sim(map, encode, &out);
+	sim.initialization();
+	if (!sendAll(fd, out))
+		return;
+	std::string pending; // command received in part
+	int runs = options.runs > 0 ? options.runs : static_cast<int>(map.runs.size());
+	for (int run = 0; run < runs; ++run) {
+		sim.start(run, options.seed + trial);
+		long long started = nowUsec();
+		while (!sim.ended()) {
+			out.clear();
+			sim.step();
+			if (!out.empty() && !sendAll(fd, out))
+				return;
+			long long deadline = started + static_cast<long long>(sim.time() * 1000.0 / options.speedup);
+			if (!receiveUntil(fd, deadline, sim, pending))
+				return;
+		}
+		static const char *outcomes[] = { "running", "success", "crater", "killed", "timeout" };
+		std::cout << "run " << run << ": " << outcomes[sim.outcome()] << " at " << sim.time()
+			<< " ms, score " << sim.score() << ", " << sim.crashes() << " crashes" << std::endl;
+	}
+}
+
+static int listenOn(int port) {
+	int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1) {
+		perror("socket");
+		return -1;
+	}
+	int flag = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&flag, sizeof(int));
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (::bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 || ::listen(fd, 1) == -1) {
+		perror("bind");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void usage() {
+	fprintf(stderr, "usage: icfpSim [-p port] [-x speedup] [-r runs] [-t trials] [-s seed] <map.wrld>\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	Options options = { 17676, 1.0, 0, 0, 0, NULL };
+	int opt;
+	while ((opt = getopt(argc, argv, "p:x:r:t:s:")) != -1) {
+		switch (opt) {
+			case 'p': options.port = atoi(optarg); break;
+			case 'x': options.speedup = atof(optarg); break;
+			case 'r': options.runs = atoi(optarg); break;
+			case 't': options.trials = atoi(optarg); break;
+			case 's': options.seed = static_cast<unsigned>(strtoul(optarg, NULL, 10)); break;
+			default: usage();
+		}
+	}
+	if (optind != argc - 1 || options.speedup <= 0.0)
+		usage();
+	options.map = argv[optind];
+
+	WorldMap map;
+	std::string error;
+	if (!map.load(options.map, error)) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+	std::cout << options.map << ": " << map.size << " m, " << map.boulders.size() << " boulders, "
+		<< map.craters.size() << " craters, " << map.runs.size() << " runs" << std::endl;
+
+	int server = listenOn(options.port);
+	if (server == -1)
+		return 1;
+	std::cout << "listening on 127.0.0.1:" << options.port << ", " << options.speedup << "x real time" << std::endl;
+	for (unsigned trial = 0; options.trials == 0 || trial < static_cast<unsigned>(options.trials); ++trial) {
+		int fd = ::accept(server, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			break;
+		}
+		int flag = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
+		std::cout << "trial " << trial << std::endl;
+		serve(fd, options, map, trial);
+		close(fd);
+	}
+	close(server);
+	return 0;
+}
@@ -0,0 +1,405 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include "protocol.h"
+#include "worldmap.h"
+#include "dynamics.h"
+#include "geometry.h"
+
+namespace Simulation {
+
+	using Communication::Protocol;
+	using Communication::OutgoingCommand;
+	using Movement::VehicleModel;
+	using Movement::VehicleState;
+	using Movement::MoveState;
+	using Movement::TurnState;
+	using Movement::CircleSet;
+	using Movement::firstOverlap;
+
+	const float SIM_ROVER_RADIUS = 0.5f; // meters
+	const float SIM_MARTIAN_RADIUS = 0.4f; // meters
+	const float SIM_HOME_RADIUS = 5.0f; // meters, around the origin
+	const int SIM_STEP_MS = 10; // simulated milliseconds per step
+	const int SIM_TELEMETRY_MS = 100; // simulated milliseconds between telemetry messages
+	const float SIM_EDGE_MARGIN = 20.0f; // meters from the map edge a Martian turns back at
+
+	// Receives every message the simulated server sends, when it is sent.
+	typedef void (*MessageHandler)(void *context, const Protocol::Message& message);
+
+	//
+	// Plays the runs of a WorldMap the way the contest server does, one step
+	// at a time: the rover and the Martians are moved by VehicleModels with
+	// the map's parameters, and everything the server would send is handed
+	// to a MessageHandler in the parser's structures. It is up to the handler
+	// to encode it for a socket or to pass it straight to a controller.
+	//
+	// Martians chase the rover once it is within their view, and otherwise
+	// roam at a fraction of their top speed. Both bounce off boulders; the
+	// rover also ends its run in craters, on Martians or at home. The score
+	// is the run's time, plus the time limit if the rover was lost.
+	//
+	// Nothing depends on the wall clock: how fast the steps are taken is up
+	// to the caller, and a run replays identically for the same seed and
+	// commands.
+	//
+	class Simulator {
+		public:
+			enum Outcome {
+				RUNNING,
+				SUCCESS,
+				CRATER,
+				KILLED,
+				TIMEOUT
+			};
+
+			Simulator(const WorldMap& map, MessageHandler handler, void *context) : m_map(&map), m_handler(handler), m_context(context), m_run(0), m_time(0), m_outcome(RUNNING), m_touching(false), m_crashes(0), m_random(1) {
+				m_rover_model.setParams(map.vehicle);
+				m_martian_model.setParams(map.martian);
+				for (std::size_t i = 0; i < map.boulders.size(); ++i) {
+					Protocol::ObjectCommon boulder = { map.boulders[i].x, map.boulders[i].y, map.boulders[i].r };
+					m_boulders.push(boulder);
+				}
+				for (std::size_t i = 0; i < map.craters.size(); ++i) {
+					Protocol::ObjectCommon crater = { map.craters[i].x, map.craters[i].y, map.craters[i].r };
+					m_craters.push(crater);
+				}
+			}
+
+			const WorldMap& map() const {
+				return *m_map;
+			}
+			int run() const {
+				return m_run;
+			}
+			// Simulated milliseconds since the start of the run.
+			int time() const {
+				return m_time;
+			}
+			bool ended() const {
+				return m_outcome != RUNNING;
+			}
+			Outcome outcome() const {
+				return m_outcome;
+			}
+			int score() const {
+				return m_outcome == CRATER || m_outcome == KILLED ? m_time + m_map->time_limit : m_time;
+			}
+			// Boulders bumped into during the run.
+			int crashes() const {
+				return m_crashes;
+			}
+			const VehicleState& rover() const {
+				return m_rover;
+			}
+
+			// Sends the initialization message, once before the first run.
+			void initialization() {
+				Protocol::Message message;
+				message.tag = Protocol::TAG_INITIALIZATION;
+				message.initialization.dx = m_map->size;
+				message.initialization.dy = m_map->size;
+				message.initialization.time_limit = m_map->time_limit;
+				message.initialization.min_sensor = m_map->rear_view;
+				message.initialization.max_sensor = m_map->front_view;
+				message.initialization.max_speed = m_map->vehicle.max_speed;
+				message.initialization.max_turn = m_map->vehicle.turn;
+				message.initialization.max_hard_turn = m_map->vehicle.hard_turn;
+				m_handler(m_context, message);
+			}
+
+			// Puts the rover and the Martians at the start of a run of the map.
+			void start(int run, unsigned seed) {
+				const RunStart& begin = m_map->runs[run % m_map->runs.size()];
+				m_run = run;
+				m_time = 0;
+				m_outcome = RUNNING;
+				m_touching = false;
+				m_crashes = 0;
+				m_random = (seed + 1) * 2654435761u ^ static_cast<unsigned>(run + 1);
+				if (m_random == 0)
+					m_random = 1;
+				m_rover = initialState(begin.x, begin.y, begin.dir);
+				m_martians.clear();
+				for (std::size_t i = 0; i < begin.enemies.size(); ++i) {
+					const EnemyStart& e = begin.enemies[i];
+					Martian martian;
+					martian.state = initialState(e.x, e.y, e.dir);
+					martian.roam_speed = e.speed * m_map->martian.max_speed;
+					martian.view = e.view;
+					martian.heading = e.dir;
+					m_martians.push_back(martian);
+				}
+			}
+
+			//
+			// Applies one command, without its terminator. False, and nothing
+			// changes, if the contest server would reject it.
+			//
+			bool command(const char *text, std::size_t length) {
+				int move, turn;
+				if (!OutgoingCommand::parse(text, length, move, turn))
+					return false;
+				if (move > 0 && m_rover.move < Movement::ACCELERATING)
+					++m_rover.move;
+				else if (move < 0 && m_rover.move > Movement::BREAKING)
+					--m_rover.move;
+				if (turn > 0 && m_rover.turn < Movement::HARD_RIGHT)
+					++m_rover.turn;
+				else if (turn < 0 && m_rover.turn > Movement::HARD_LEFT)
+					--m_rover.turn;
+				return true;
+			}
+
+			//
+			// Advances the run by SIM_STEP_MS, sending the telemetry due at its
+			// start and the events that happen during it; the last step of a
+			// run sends the end of run message.
+			//
+			void step() {
+				if (ended())
+					return;
+				if (m_time % SIM_TELEMETRY_MS == 0) {
+					steerMartians();
+					telemetry();
+				}
+				float dt = SIM_STEP_MS * 0.001f;
+				m_rover_model.step(m_rover, dt);
+				for (std::size_t i = 0; i < m_martians.size(); ++i) {
+					m_martian_model.step(m_martians[i].state, dt);
+					bounce(m_martians[i].state, SIM_MARTIAN_RADIUS, m_boulders);
+					bounce(m_martians[i].state, SIM_MARTIAN_RADIUS, m_craters);
+				}
+				m_time += SIM_STEP_MS;
+
+				bool touching = bounce(m_rover, SIM_ROVER_RADIUS, m_boulders);
+				if (touching && !m_touching) {
+					++m_crashes;
+					event(Protocol::TAG_CRASH);
+				}
+				m_touching = touching;
+				if (inside(m_rover, m_craters)) {
+					m_outcome = CRATER;
+					event(Protocol::TAG_FELL_INTO_CRATER);
+				} else if (caught()) {
+					m_outcome = KILLED;
+					event(Protocol::TAG_KILLED_BY_MARTIAN);
+				} else if (m_rover.x * m_rover.x + m_rover.y * m_rover.y < SIM_HOME_RADIUS * SIM_HOME_RADIUS) {
+					m_outcome = SUCCESS;
+					event(Protocol::TAG_SUCCESS);
+				} else if (m_time >= m_map->time_limit) {
+					m_outcome = TIMEOUT;
+				}
+				if (ended()) {
+					Protocol::Message message;
+					message.tag = Protocol::TAG_END_OF_RUN;
+					message.end.time_stamp = m_time;
+					message.end.score = score();
+					m_handler(m_context, message);
+				}
+			}
+
+		private:
+			struct Martian {
+				VehicleState state;
+				float roam_speed; // meters per second
+				float view; // meters
+				float heading; // degrees it roams towards
+			};
+
+			static VehicleState initialState(float x, float y, float dir) {
+				VehicleState s;
+				s.x = x;
+				s.y = y;
+				s.dir = dir;
+				s.speed = 0.0f;
+				s.turn_rate = 0.0f;
+				s.move = Movement::ROLLING;
+				s.turn = Movement::STRAIGHT;
+				return s;
+			}
+
+			// Pushes s out of any circle it overlaps and stops it there; true if it did.
+			static bool bounce(VehicleState& s, float radius, const Protocol::CircleArray& circles) {
+				CircleSet set(circles.x, circles.y, circles.radius);
+				bool hit = false;
+				for (std::size_t i = firstOverlap(set, s.x, s.y, radius); i < set.size; i = firstOverlap(set, s.x, s.y, radius, i + 1)) {
+					float dx = s.x - set.x[i], dy = s.y - set.y[i];
+					float reach = set.r[i] + radius;
+					float distance = std::sqrt(dx * dx + dy * dy);
+					if (distance > 0.0f) {
+						s.x = set.x[i] + dx / distance * reach;
+						s.y = set.y[i] + dy / distance * reach;
+					}
+					s.speed = 0.0f;
+					hit = true;
+				}
+				return hit;
+			}
+
+			// Whether the center of s lies within any of the circles.
+			static bool inside(const VehicleState& s, const Protocol::CircleArray& circles) {
+				CircleSet set(circles.x, circles.y, circles.radius);
+				return firstOverlap(set, s.x, s.y, 0.0f) < set.size;
+			}
+
+			bool caught() const {
+				const float reach = SIM_ROVER_RADIUS + SIM_MARTIAN_RADIUS;
+				for (std::size_t i = 0; i < m_martians.size(); ++i) {
+					float dx = m_rover.x - m_martians[i].state.x, dy = m_rover.y - m_martians[i].state.y;
+					if (dx * dx + dy * dy < reach * reach)
+						return true;
+				}
+				return false;
+			}
+
+			//
+			// Whether a circle is within the rover's view: an ellipse reaching
+			// front_view ahead and rear_view behind, with the rover at a focus.
+			//
+			bool visible(float x, float y, float r) const {
+				float front = m_map->front_view, rear = m_map->rear_view;
+				float heading = m_rover.dir * static_cast<float>(M_PI) / 180.0f;
+				float hx = std::cos(heading), hy = std::sin(heading);
+				float offset = (front - rear) * 0.5f;
+				float dx = x - (m_rover.x + hx * offset), dy = y - (m_rover.y + hy * offset);
+				float u = (dx * hx + dy * hy) / ((front + rear) * 0.5f + r);
+				float v = (dy * hx - dx * hy) / (std::sqrt(front * rear) + r);
+				return u * u + v * v <= 1.0f;
+			}
+
+			void telemetry() {
+				static const char move_ctl[] = { 'b', '-', 'a' };
+				static const char turn_ctl[] = { 'L', 'l', '-', 'r', 'R' };
+				m_objects.clear();
+				addCircles(m_objects.boulders, m_boulders);
+				addCircles(m_objects.craters, m_craters);
+				if (visible(0.0f, 0.0f, SIM_HOME_RADIUS)) {
+					Protocol::ObjectCommon home = { 0.0f, 0.0f, SIM_HOME_RADIUS };
+					m_objects.homes.push(home);
+				}
+				for (std::size_t i = 0; i < m_martians.size(); ++i) {
+					const VehicleState& s = m_martians[i].state;
+					if (!visible(s.x, s.y, SIM_MARTIAN_RADIUS))
+						continue;
+					Protocol::ObjectMartian martian = { s.x, s.y, s.dir, s.speed };
+					m_objects.martians.push(martian);
+				}
+				Protocol::Message message;
+				message.tag = Protocol::TAG_TELEMETRY_STREAM;
+				message.telemetry.timestamp = m_time;
+				message.telemetry.vehicle_ctl[0] = move_ctl[m_rover.move - Movement::BREAKING];
+				message.telemetry.vehicle_ctl[1] = turn_ctl[m_rover.turn - Movement::HARD_LEFT];
+				message.telemetry.vehicle_x = m_rover.x;
+				message.telemetry.vehicle_y = m_rover.y;
+				message.telemetry.vehicle_dir = m_rover.dir;
+				message.telemetry.vehicle_speed = m_rover.speed;
+				message.telemetry.objects = &m_objects;
+				m_handler(m_context, message);
+			}
+
+			void addCircles(Protocol::CircleArray& out, const Protocol::CircleArray& circles) const {
+				for (std::size_t i = 0; i < circles.size(); ++i) {
+					if (visible(circles.x[i], circles.y[i], circles.radius[i]))
+						out.push(circles.at(i));
+				}
+			}
+
+			void event(Protocol::MessageTag tag) {
+				Protocol::Message message;
+				message.tag = tag;
+				message.event.time_stamp = m_time;
+				m_handler(m_context, message);
+			}
+
+			//
+			// Picks every Martian's control state for the next telemetry period:
+			// head for the rover if it is in view, otherwise drift around at the
+			// roaming speed, in both cases turning away from the obstacle ahead
+			// and back from the map edge.
+			//
+			void steerMartians() {
+				float limit = m_map->size * 0.5f - SIM_EDGE_MARGIN;
+				for (std::size_t i = 0; i < m_martians.size(); ++i) {
+					Martian& martian = m_martians[i];
+					VehicleState& s = martian.state;
+					float dx = m_rover.x - s.x, dy = m_rover.y - s.y;
+					float target;
+					if (dx * dx + dy * dy < martian.view * martian.view) {
+						target = degrees(std::atan2(dy, dx));
+						s.move = Movement::ACCELERATING;
+					} else {
+						martian.heading += (random() - 0.5f) * 30.0f;
+						target = martian.heading;
+						if (s.speed < martian.roam_speed)
+							s.move = Movement::ACCELERATING;
+						else
+							s.move = s.speed > martian.roam_speed * 1.2f ? Movement::BREAKING : Movement::ROLLING;
+					}
+					if (std::fabs(s.x) > limit || std::fabs(s.y) > limit)
+						target = martian.heading = degrees(std::atan2(-s.y, -s.x));
+					float away;
+					if (obstacleAhead(s, m_boulders, away) || obstacleAhead(s, m_craters, away))
+						target = s.dir + away;
+					float error = std::fmod(target - s.dir + 540.0f, 360.0f) - 180.0f;
+					if (error > m_map->martian.turn)
+						s.turn = Movement::HARD_LEFT;
+					else if (error > 3.0f)
+						s.turn = Movement::LEFT;
+					else if (error < -m_map->martian.turn)
+						s.turn = Movement::HARD_RIGHT;
+					else if (error < -3.0f)
+						s.turn = Movement::RIGHT;
+					else
+						s.turn = Movement::STRAIGHT;
+				}
+			}
+
+			// Whether a circle lies within a second's travel ahead of s; `away` is the turn clearing it.
+			static bool obstacleAhead(const VehicleState& s, const Protocol::CircleArray& circles, float& away) {
+				CircleSet set(circles.x, circles.y, circles.radius);
+				float reach = s.speed + SIM_MARTIAN_RADIUS * 2.0f;
+				for (std::size_t i = firstOverlap(set, s.x, s.y, reach); i < set.size; i = firstOverlap(set, s.x, s.y, reach, i + 1)) {
+					float dx = set.x[i] - s.x, dy = set.y[i] - s.y;
+					float bearing = std::fmod(degrees(std::atan2(dy, dx)) - s.dir + 540.0f, 360.0f) - 180.0f;
+					if (std::fabs(bearing) > 45.0f)
+						continue;
+					away = bearing > 0.0f ? -90.0f : 90.0f;
+					return true;
+				}
+				return false;
+			}
+
+			static float degrees(float radians) {
+				return radians * 180.0f / static_cast<float>(M_PI);
+			}
+
+			// Uniform in [0, 1), from a xorshift generator.
+			float random() {
+				m_random ^= m_random << 13;
+				m_random ^= m_random >> 17;
+				m_random ^= m_random << 5;
+				return (m_random >> 8) * (1.0f / 16777216.0f);
+			}
+
+			const WorldMap *m_map;
+			MessageHandler m_handler;
+			void *m_context;
+			Protocol::ObjectStore m_objects; // of the last telemetry message
+			Protocol::CircleArray m_boulders; // the map's, laid out for the geometry kernels
+			Protocol::CircleArray m_craters;
+			VehicleModel m_rover_model;
+			VehicleModel m_martian_model;
+			VehicleState m_rover;
+			std::vector<Martian> m_martians;
+			int m_run;
+			int m_time;
+			Outcome m_outcome;
+			bool m_touching; // against a boulder at the end of the last step
+			int m_crashes;
+			unsigned m_random;
+	};
+
+}
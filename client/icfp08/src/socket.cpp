@@ -1,5 +1,11 @@
 #include "socket.h"
 #include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <arpa/inet.h>
@@ -39,12 +45,11 @@ namespace Communication {
 			return false;
 		}
 
-//		int flag = 1;
-//		int result = setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int));
-//		if (result < 0) {
-//			perror("setsockopt");
-//			// TODO must return false?
-//		}
+		// Commands are a few bytes each: send them right away instead of
+		// waiting for the previous ones to be acknowledged.
+		int flag = 1;
+		if (setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(int)) < 0)
+			perror("setsockopt");
 
 		return true;
 	}
@@ -70,7 +75,8 @@ namespace Communication {
 	int Socket::write(const void * data, size_t size) {
 		int ret = send(_fd, data, size, 0);
 		if (ret == -1) {
-			perror("send");
+			if (errno != EAGAIN)
+				perror("send");
 		}
 		return ret;
 	}
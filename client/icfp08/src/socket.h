@@ -16,6 +16,7 @@ namespace Communication {
 			bool lookupHost(const std::string& host, struct in_addr * ipaddr) const;
 			std::string hostname() const { return _hostname; }
 			int port() const { return _port; }
+			int fd() const { return _fd; }
 			bool connect();
 			bool disconnect();
 			int read(void * data, std::size_t size);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+//
+// Bounded ring of preallocated slots between one producer thread and one
+// consumer thread, without locks.
+//
+// Each side owns one index and only reads the other's, so push() and pop()
+// are a copy and an atomic store. A push() into a full queue fails and is
+// counted as a drop; the deepest the queue has been is kept as well. A push
+// may also keep slots free for later ones that must not fail.
+//
+template <typename T>
+class SpscQueue {
+	public:
+		// Rounded up to a power of two.
+		SpscQueue(std::size_t capacity) : m_head(0), m_tail(0), m_pushed(0), m_drops(0), m_high_water(0) {
+			std::size_t size = 1;
+			while (size < capacity)
+				size <<= 1;
+			m_slots.resize(size);
+			m_mask = size - 1;
+		}
+
+		std::size_t capacity() const {
+			return m_slots.size();
+		}
+
+		// Producer side. Fails unless `reserve` slots are still free after this one.
+		bool push(const T& value, std::size_t reserve = 0) {
+			std::size_t tail = m_tail;
+			std::size_t depth = tail - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+			if (depth + reserve >= m_slots.size()) {
+				++m_drops;
+				return false;
+			}
+			m_slots[tail & m_mask] = value;
+			__atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+			++m_pushed;
+			if (depth + 1 > m_high_water)
+				m_high_water = depth + 1;
+			return true;
+		}
+		unsigned long pushed() const {
+			return m_pushed;
+		}
+		unsigned long drops() const {
+			return m_drops;
+		}
+		std::size_t highWater() const {
+			return m_high_water;
+		}
+
+		// Consumer side.
+		bool pop(T& value) {
+			std::size_t head = m_head;
+			if (head == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE))
+				return false;
+			value = m_slots[head & m_mask];
+			__atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+			return true;
+		}
+		bool empty() const {
+			return __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+		}
+
+	private:
+		std::vector<T> m_slots;
+		std::size_t m_mask;
+		// Each index on its own cache line, so the two sides do not share one.
+		char m_pad0[64];
+		std::size_t m_head; // consumer's
+		char m_pad1[64];
+		std::size_t m_tail; // producer's
+		unsigned long m_pushed; // producer's, like the stats below
+		unsigned long m_drops;
+		std::size_t m_high_water;
+		char m_pad2[64];
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <cstdio>
+#include <ctime>
+#include <stdint.h>
+
+//
+// Counts of nanosecond latencies in log-linear buckets, HDR style: every
+// power of two is split into SUB_BUCKETS linear ones, which keeps about 6%
+// precision from 1 ns to hours in a few kilobytes.
+//
+// Any thread may record(); the counts are bumped atomically, without a lock.
+//
+class LatencyHistogram {
+	public:
+		static const int SUB_BITS = 4;
+		static const int SUB_BUCKETS = 1 << SUB_BITS;
+		static const int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+		LatencyHistogram() {
+			reset();
+		}
+
+		void record(int64_t nsec) {
+			uint64_t value = nsec > 0 ? static_cast<uint64_t>(nsec) : 0;
+			__atomic_fetch_add(&m_counts[bucket(value)], 1, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&m_count, 1, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&m_total, value, __ATOMIC_RELAXED);
+			uint64_t max = __atomic_load_n(&m_max, __ATOMIC_RELAXED);
+			while (value > max && !__atomic_compare_exchange_n(&m_max, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				;
+		}
+		void reset() {
+			for (int i = 0; i < BUCKETS; ++i)
+				__atomic_store_n(&m_counts[i], 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&m_count, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&m_total, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&m_max, 0, __ATOMIC_RELAXED);
+		}
+
+		uint64_t count() const {
+			return __atomic_load_n(&m_count, __ATOMIC_RELAXED);
+		}
+		uint64_t max() const {
+			return __atomic_load_n(&m_max, __ATOMIC_RELAXED);
+		}
+		double mean() const {
+			uint64_t n = count();
+			return n > 0 ? static_cast<double>(__atomic_load_n(&m_total, __ATOMIC_RELAXED)) / n : 0.0;
+		}
+		// Upper bound of the bucket holding the nearest-rank percentile (0-100).
+		uint64_t percentile(double p) const {
+			uint64_t n = count();
+			if (n == 0)
+				return 0;
+			uint64_t rank = static_cast<uint64_t>(n * p / 100.0 + 0.5);
+			if (rank < 1)
+				rank = 1;
+			uint64_t seen = 0;
+			for (int i = 0; i < BUCKETS; ++i) {
+				seen += __atomic_load_n(&m_counts[i], __ATOMIC_RELAXED);
+				if (seen >= rank) {
+					uint64_t upper = highest(i);
+					return upper < max() ? upper : max();
+				}
+			}
+			return max();
+		}
+
+	private:
+		static int bucket(uint64_t value) {
+			if (value < static_cast<uint64_t>(SUB_BUCKETS))
+				return static_cast<int>(value);
+			int magnitude = 63 - __builtin_clzll(value);
+			int shift = magnitude - SUB_BITS;
+			return (shift + 1) * SUB_BUCKETS + static_cast<int>((value >> shift) - SUB_BUCKETS);
+		}
+		// Largest value counted in a bucket.
+		static uint64_t highest(int bucket) {
+			if (bucket < SUB_BUCKETS)
+				return bucket;
+			int shift = bucket / SUB_BUCKETS - 1;
+			uint64_t top = bucket % SUB_BUCKETS + SUB_BUCKETS;
+			return ((top + 1) << shift) - 1;
+		}
+
+		uint64_t m_counts[BUCKETS];
+		uint64_t m_count;
+		uint64_t m_total;
+		uint64_t m_max;
+};
+
+//
+// Where the time of a tick goes: a histogram per stage of the pipeline,
+// from the socket to the planner and back.
+//
+// The server's clock only counts the milliseconds since the run started, so
+// its offset to ours is taken from the least delayed telemetry of the run:
+// WIRE is how much later than that one a telemetry arrived, and
+// WIRE_TO_COMMAND how long after its time stamp, on that basis, the command
+// decided on it was written.
+//
+class Timings {
+	public:
+		enum Stage {
+			RECEIVE,			// reading the socket
+			FRAME,				// splitting a message off the receive buffer
+			PARSE,
+			UPDATE,				// ControllerState::update()
+			PLAN,				// PathFind::adjustCourse()
+			SEND,				// writing a command
+			WIRE,				// telemetry delay, past the least delayed one
+			WIRE_TO_COMMAND,	// telemetry time stamp to command written
+			STAGES
+		};
+
+		static Timings& instance() {
+			static Timings timings;
+			return timings;
+		}
+
+		static int64_t now() {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			return static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+		}
+
+		void record(Stage stage, int64_t nsec) {
+			m_stages[stage].record(nsec);
+		}
+		const LatencyHistogram& histogram(Stage stage) const {
+			return m_stages[stage];
+		}
+
+		// A telemetry message stamped `time_stamp` (milliseconds) just arrived; I/O thread.
+		void telemetryReceived(int time_stamp) {
+			int64_t offset = now() - static_cast<int64_t>(time_stamp) * 1000000;
+			if (!m_offset_known || offset < m_offset) {
+				m_offset = offset;
+				m_offset_known = true;
+			}
+			record(WIRE, offset - m_offset);
+		}
+		// The planner is deciding on the telemetry stamped `time_stamp`; planner thread.
+		void planning(int time_stamp) {
+			__atomic_store_n(&m_planned, time_stamp, __ATOMIC_RELAXED);
+		}
+		int planned() const {
+			return __atomic_load_n(&m_planned, __ATOMIC_RELAXED);
+		}
+		// A command decided on the telemetry stamped `time_stamp` was just written; I/O thread.
+		void commandSent(int time_stamp) {
+			if (m_offset_known)
+				record(WIRE_TO_COMMAND, now() - (static_cast<int64_t>(time_stamp) * 1000000 + m_offset));
+		}
+
+		// Starts over, as the server's clock does with every run.
+		void reset() {
+			for (int i = 0; i < STAGES; ++i)
+				m_stages[i].reset();
+			m_offset_known = false;
+		}
+
+		static const char *stageName(Stage stage) {
+			static const char *names[] = { "receive", "frame", "parse", "update", "plan", "send", "wire", "wire_to_command" };
+			return names[stage];
+		}
+
+		// A line of the table of header(), in microseconds.
+		const char *format(Stage stage, char *line, std::size_t size) const {
+			const LatencyHistogram& h = m_stages[stage];
+			snprintf(line, size, "%-16s %7llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f",
+				stageName(stage), static_cast<unsigned long long>(h.count()), h.mean() * 1e-3,
+				h.percentile(50) * 1e-3, h.percentile(90) * 1e-3, h.percentile(99) * 1e-3,
+				h.percentile(99.9) * 1e-3, h.max() * 1e-3);
+			return line;
+		}
+		static const char *header() {
+			return "stage              count  mean(us)   p50(us)   p90(us)   p99(us) p99.9(us)   max(us)";
+		}
+
+		// Appends a CSV row per stage, the header first if the file is empty.
+		void writeCsv(FILE *out, int run) const {
+			if (ftell(out) == 0)
+				fprintf(out, "run,stage,count,mean_us,p50_us,p90_us,p99_us,p999_us,max_us\n");
+			for (int i = 0; i < STAGES; ++i) {
+				const LatencyHistogram& h = m_stages[i];
+				fprintf(out, "%d,%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", run, stageName(static_cast<Stage>(i)),
+					static_cast<unsigned long long>(h.count()), h.mean() * 1e-3,
+					h.percentile(50) * 1e-3, h.percentile(90) * 1e-3, h.percentile(99) * 1e-3,
+					h.percentile(99.9) * 1e-3, h.max() * 1e-3);
+			}
+			fflush(out);
+		}
+
+	private:
+		Timings() : m_offset(0), m_offset_known(false), m_planned(0) {
+			// nop
+		}
+
+		LatencyHistogram m_stages[STAGES];
+		int64_t m_offset; // our clock minus the server's, least delayed (nanoseconds); I/O thread's
+		bool m_offset_known;
+		int m_planned; // time stamp of the telemetry being planned on
+};
+
+//
+// Records the time until it goes out of scope into a stage.
+//
+class StageTimer {
+	public:
+		StageTimer(Timings::Stage stage) : m_stage(stage), m_started(Timings::now()) {
+			// nop
+		}
+		~StageTimer() {
+			Timings::instance().record(m_stage, Timings::now() - m_started);
+		}
+	private:
+		Timings::Stage m_stage;
+		int64_t m_started;
+};
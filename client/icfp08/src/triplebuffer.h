@@ -0,0 +1,46 @@
+#pragma once
+
+//
+// Hands the latest copy of a value from one writer thread to one reader
+// thread, wait-free on both sides.
+//
+// The writer fills back() and publish()es it; the reader calls update() and
+// then reads front(), which stays untouched until its next update(). Three
+// slots mean neither side ever waits for the other nor sees a half-written
+// value: the third one is the freshest published copy, swapped atomically.
+//
+template <typename T>
+class TripleBuffer {
+	public:
+		TripleBuffer() : m_write(0), m_read(1), m_middle(2) {
+			// nop
+		}
+
+		// Writer side. back() holds stale data: fill it completely.
+		T& back() {
+			return m_slots[m_write];
+		}
+		void publish() {
+			m_write = __atomic_exchange_n(&m_middle, m_write | FRESH, __ATOMIC_ACQ_REL) & INDEX;
+		}
+
+		// Reader side. Returns whether front() changed.
+		bool update() {
+			if ((__atomic_load_n(&m_middle, __ATOMIC_ACQUIRE) & FRESH) == 0)
+				return false;
+			m_read = __atomic_exchange_n(&m_middle, m_read, __ATOMIC_ACQ_REL) & INDEX;
+			return true;
+		}
+		const T& front() const {
+			return m_slots[m_read];
+		}
+
+	private:
+		static const int INDEX = 3;
+		static const int FRESH = 4;
+
+		T m_slots[3];
+		int m_write; // owned by the writer
+		int m_read; // owned by the reader
+		int m_middle; // last published slot, FRESH until the reader takes it
+};
@@ -0,0 +1,521 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <queue>
+#include <cmath>
+#include <ctime>
+#include <limits>
+#include <unordered_map>
+#include "vector2.h"
+#include "worldmodel.h"
+#include "geometry.h"
+#include "gridplanner.h"
+
+namespace Movement {
+
+	const float ARC_STEP = 1.0f; // meters between arc collision samples
+	const float ARC_WAYPOINT_ANGLE = 0.5f; // radians between arc waypoints
+	const float START_ESCAPE_ANGLE = 0.25f; // radians outwards a start inside an obstacle leaves it at
+	const float START_ESCAPE_LEG = 2.0f; // meters it heads that way for
+	const float START_CLEARANCE_SLACK = 0.95f; // of its clearance a start inside obstacles may lose
+
+	//
+	// Shortest paths among circular obstacles, made of tangent segments and arcs.
+	//
+	// Every obstacle is grown by the inflation and may be rounded clockwise or
+	// counterclockwise. Between two (circle, direction) pairs there is exactly one
+	// tangent segment, so A* runs over states "arrived on circle j, rounding it in
+	// direction dj" and expands them into tangents towards the nearby circles and
+	// towards the goal, plus the arc walked on the circle before leaving it.
+	//
+	// A start inside a grown obstacle lies on that obstacle shrunk to pass
+	// through it, and leaves it along a tangent either way, never heading
+	// further in; tangents of the shrunk obstacle are not cached.
+	//
+	// A segment leaving the start costs, on top of its length, the arc the
+	// vehicle turns along to head its way, as setHeading() was told: of two
+	// ways around an obstacle about as long, the one ahead is kept, rather
+	// than a moving vehicle being sent back and forth between them.
+	//
+	// Tangents between obstacles are computed lazily, the first time a search
+	// needs them, and cached with their validity. As obstacles only ever get
+	// added, a cached tangent is re-checked against the obstacles seen since its
+	// last check only, and one found blocked stays blocked.
+	//
+	class VisibilityPlanner {
+		public:
+			VisibilityPlanner() : m_budget_usec(20000), m_neighborhood(50.0f), m_inflation(-1.0f), m_goal(Vector2::ZERO), m_world_size(0), m_heading(Vector2::ZERO), m_turn_radius(0.0f), m_start_inside(-1), m_start_radius(0.0f), m_start_clearance(0.0f), m_expanded(0) {
+				// nop
+			}
+
+			void setBudget(long usec) {
+				m_budget_usec = usec;
+			}
+			// Tangents are only searched towards obstacles this close (meters).
+			void setNeighborhood(float meters) {
+				m_neighborhood = meters;
+			}
+			// Direction the vehicle moves in, and the radius it turns at, for the next plan().
+			void setHeading(const Vector2& heading, float turn_radius) {
+				m_heading = heading;
+				m_turn_radius = turn_radius;
+			}
+			const std::vector<Vector2>& path() const {
+				return m_path;
+			}
+			int expanded() const {
+				return m_expanded;
+			}
+			std::size_t cachedEdges() const {
+				return m_edges.size();
+			}
+
+			//
+			// Plans from `from` to `to` around the world model obstacles grown by
+			// `inflation`.
+			//
+			GridPlanner::Result plan(WorldModel& world, const Vector2& from, const Vector2& to, float inflation) {
+				m_path.clear();
+				m_expanded = 0;
+				if (inflation != m_inflation || world.size() < m_world_size || to != m_goal) {
+					m_edges.clear();
+					m_inflation = inflation;
+					m_goal = to;
+				}
+				m_world_size = world.size();
+
+				struct timespec deadline;
+				clock_gettime(CLOCK_MONOTONIC, &deadline);
+				deadline.tv_sec += m_budget_usec / 1000000;
+				deadline.tv_nsec += (m_budget_usec % 1000000) * 1000;
+				if (deadline.tv_nsec >= 1000000000) {
+					deadline.tv_nsec -= 1000000000;
+					++deadline.tv_sec;
+				}
+
+				m_start_inside = findStart(world, from);
+				m_start_radius = m_start_inside == -1 ? 0.0f : (from - center(world, m_start_inside)).length();
+
+				m_states.clear();
+				m_index.clear();
+				m_open = OpenList();
+				State start;
+				start.point = from;
+				start.depart = from;
+				if (m_start_inside != -1) {
+					Vector2 radial = from - center(world, m_start_inside);
+					start.circle = m_start_inside;
+					start.angle = std::atan2(radial.y, radial.x);
+					start.depart_angle = start.angle;
+					// Both ways around, the second a state of its own.
+					m_states.push_back(start);
+					start.dir = -1;
+					m_open.push(std::make_pair((to - from).length(), 1));
+				}
+				m_states.push_back(start);
+				m_open.push(std::make_pair((to - from).length(), 0));
+
+				int best = 0, goal = -1;
+				float best_h = (to - from).length();
+				GridPlanner::Result result = GridPlanner::NO_PATH;
+				while (!m_open.empty()) {
+					int u = m_open.top().second;
+					m_open.pop();
+					if (m_states[u].closed)
+						continue;
+					m_states[u].closed = true;
+					++m_expanded;
+					if (m_states[u].circle == GOAL) {
+						goal = u;
+						result = GridPlanner::FOUND_PATH;
+						break;
+					}
+					float h = (to - m_states[u].point).length();
+					if (h < best_h && m_states[u].parent != -1) {
+						best_h = h;
+						best = u;
+					}
+					if ((m_expanded & 15) == 0) {
+						struct timespec now;
+						clock_gettime(CLOCK_MONOTONIC, &now);
+						if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+							result = GridPlanner::PARTIAL_PATH;
+							break;
+						}
+					}
+					expand(world, u, to);
+				}
+				int last = goal != -1 ? goal : best;
+				if (result == GridPlanner::NO_PATH && m_states[best].parent != -1)
+					result = GridPlanner::PARTIAL_PATH;
+				if (result != GridPlanner::NO_PATH) {
+					buildPath(world, last);
+					if (m_start_inside != -1)
+						leaveStart(world, m_states[m_chain.back()].dir);
+				}
+				return result;
+			}
+
+		private:
+			static const int START = -1;
+			static const int GOAL = -2;
+
+			// A tangent segment leaving one circle (or point) and reaching another.
+			struct Tangent {
+				Vector2 from;
+				Vector2 to;
+				float from_angle; // on the circle it leaves
+				float to_angle; // on the circle it reaches
+				float length;
+
+				Tangent() : from(Vector2::ZERO), to(Vector2::ZERO), from_angle(0.0f), to_angle(0.0f), length(0.0f) {
+					// nop
+				}
+			};
+			struct Edge {
+				Tangent tangent;
+				bool exists; // circles too close for this kind of tangent
+				bool valid; // no other obstacle crosses it
+				std::size_t validated; // obstacles checked so far
+
+				Edge() : tangent(), exists(false), valid(false), validated(0) {
+					// nop
+				}
+			};
+			struct State {
+				int circle; // obstacle index, START or GOAL
+				int dir; // +1 counterclockwise, -1 clockwise
+				float angle; // where it arrived on the circle
+				Vector2 point; // ... and in world coordinates
+				float depart_angle; // where it left the parent circle
+				Vector2 depart;
+				float g;
+				int parent;
+				bool closed;
+
+				State() : circle(START), dir(1), angle(0.0f), point(Vector2::ZERO), depart_angle(0.0f), depart(Vector2::ZERO), g(0.0f), parent(-1), closed(false) {
+					// nop
+				}
+			};
+			typedef std::pair<float, int> OpenEntry;
+			typedef std::priority_queue<OpenEntry, std::vector<OpenEntry>, std::greater<OpenEntry> > OpenList;
+
+			static unsigned long long key(int i, int di, int j, int dj) {
+				return (static_cast<unsigned long long>(i + 2) << 32)
+					| (static_cast<unsigned long long>(di > 0) << 31)
+					| (static_cast<unsigned long long>(j + 2) << 1)
+					| static_cast<unsigned long long>(dj > 0);
+			}
+
+			//
+			// Tangent leaving circle (ci, ri) while rounding it in direction di and
+			// reaching circle (cj, rj) rounding it in direction dj. Points are circles
+			// of radius 0. Returns false when no such tangent exists.
+			//
+			static bool tangent(const Vector2& ci, float ri, int di, const Vector2& cj, float rj, int dj, Tangent& t) {
+				Vector2 d = cj - ci;
+				float length = d.length();
+				float k = ri * di - rj * dj;
+				if (length <= std::fabs(k) || length == 0.0f)
+					return false;
+				// The unit normal m = (u.y, -u.x) of the segment direction u satisfies d.m = k.
+				float normal_angle = std::atan2(d.y, d.x) - std::acos(k / length);
+				Vector2 m(std::cos(normal_angle), std::sin(normal_angle));
+				t.from = ci + m * (ri * di);
+				t.to = cj + m * (rj * dj);
+				t.from_angle = di > 0 ? normal_angle : normal_angle + M_PI;
+				t.to_angle = dj > 0 ? normal_angle : normal_angle + M_PI;
+				t.length = (t.to - t.from).length();
+				return true;
+			}
+
+			float grown(const WorldModel& world, int i) const {
+				return i == m_start_inside ? m_start_radius : world.radius[i] + m_inflation;
+			}
+			Vector2 center(const WorldModel& world, int i) const {
+				return Vector2(world.x[i], world.y[i]);
+			}
+
+			//
+			// Cached tangent between two obstacles (j may be GOAL), validated
+			// against the obstacles that appeared since it was last checked.
+			//
+			const Edge& edge(WorldModel& world, int i, int di, int j, int dj, const Vector2& goal) {
+				bool cached = i != m_start_inside && j != m_start_inside;
+				std::pair<std::unordered_map<unsigned long long, Edge>::iterator, bool> inserted(m_edges.end(), true);
+				if (cached)
+					inserted = m_edges.insert(std::make_pair(key(i, di, j, dj), Edge()));
+				Edge& e = cached ? inserted.first->second : m_shrunk_edge;
+				if (inserted.second) {
+					e.exists = j == GOAL
+						? tangent(center(world, i), grown(world, i), di, goal, 0.0f, 1, e.tangent)
+						: tangent(center(world, i), grown(world, i), di, center(world, j), grown(world, j), dj, e.tangent);
+					if (i == m_start_inside)
+						e.valid = e.exists && !startSegmentBlocked(world, e.tangent.from, e.tangent.to, j);
+					else
+						e.valid = e.exists && !world.segmentIntersects(e.tangent.from, e.tangent.to, m_inflation, i, j);
+					e.validated = world.size();
+				} else if (e.valid && e.validated < world.size()) {
+					CircleSet circles(world.x, world.y, world.radius);
+					const Vector2& a = e.tangent.from;
+					const Vector2& b = e.tangent.to;
+					for (std::size_t k = firstSegmentHit(circles, a.x, a.y, b.x, b.y, m_inflation, e.validated);
+						k < circles.size; k = firstSegmentHit(circles, a.x, a.y, b.x, b.y, m_inflation, k + 1))
+					{
+						if (static_cast<int>(k) != i && static_cast<int>(k) != j) {
+							e.valid = false;
+							break;
+						}
+					}
+					e.validated = world.size();
+				}
+				return e;
+			}
+
+			// Length of the arc walked from angle a to angle b in direction dir.
+			static float arcAngle(float a, float b, int dir) {
+				float delta = std::fmod((b - a) * dir, 2.0f * static_cast<float>(M_PI));
+				return delta < 0.0f ? delta + 2.0f * static_cast<float>(M_PI) : delta;
+			}
+
+			// Whether walking the arc would run into another obstacle.
+			bool arcBlocked(WorldModel& world, int circle, float from_angle, float sweep, int dir) {
+				float r = grown(world, circle);
+				int steps = static_cast<int>(sweep * r / ARC_STEP) + 1;
+				Vector2 c = center(world, circle);
+				for (int s = 1; s < steps; ++s) {
+					float a = from_angle + dir * sweep * s / steps;
+					Vector2 p = c + Vector2(std::cos(a), std::sin(a)) * r;
+					world.queryRadius(p, m_inflation, m_nearby);
+					for (std::size_t n = 0; n < m_nearby.size(); ++n) {
+						int k = m_nearby[n];
+						if (k == circle)
+							continue;
+						if (circle == m_start_inside && isStartObstacle(k)
+							&& (p - center(world, k)).length() >= world.radius[k] + m_start_clearance)
+							continue;
+						return true;
+					}
+				}
+				return false;
+			}
+
+			//
+			// Finds the grown obstacles `point` lies in, and how far it is from
+			// the nearest of them. Returns the one it lies deepest in, relative
+			// to its size, which the start is put on; -1 if none.
+			//
+			int findStart(WorldModel& world, const Vector2& point) {
+				world.queryRadius(point, m_inflation, m_nearby);
+				m_start_obstacles.clear();
+				m_start_clearance = m_inflation;
+				int deepest = -1;
+				float deepest_ratio = 1.0f;
+				for (std::size_t n = 0; n < m_nearby.size(); ++n) {
+					int i = m_nearby[n];
+					float distance = (point - center(world, i)).length();
+					if (distance >= world.radius[i] + m_inflation)
+						continue;
+					m_start_obstacles.push_back(i);
+					m_start_clearance = std::min(m_start_clearance, distance - world.radius[i]);
+					float ratio = distance / (world.radius[i] + m_inflation);
+					if (ratio < deepest_ratio) {
+						deepest_ratio = ratio;
+						deepest = i;
+					}
+				}
+				m_start_clearance *= START_CLEARANCE_SLACK;
+				return deepest;
+			}
+			bool isStartObstacle(int k) const {
+				return std::find(m_start_obstacles.begin(), m_start_obstacles.end(), k) != m_start_obstacles.end();
+			}
+
+			//
+			// Whether a segment leaving the start obstacle towards `j` runs into
+			// another obstacle: the grown ones the start already lies in only
+			// count if it gets closer to them than the start is.
+			//
+			bool startSegmentBlocked(const WorldModel& world, const Vector2& a, const Vector2& b, int j) const {
+				CircleSet circles(world.x, world.y, world.radius);
+				for (std::size_t k = firstSegmentHit(circles, a.x, a.y, b.x, b.y, m_inflation, 0);
+					k < circles.size; k = firstSegmentHit(circles, a.x, a.y, b.x, b.y, m_inflation, k + 1))
+				{
+					int hit = static_cast<int>(k);
+					if (hit == m_start_inside || hit == j)
+						continue;
+					if (isStartObstacle(hit)) {
+						float reach = world.radius[hit] + m_start_clearance;
+						if (WorldModel::distanceSqToSegment(center(world, hit), a, b) >= reach * reach)
+							continue;
+					}
+					return true;
+				}
+				return false;
+			}
+
+			void relax(int u, int circle, int dir, const Tangent& t, float arc, const Vector2& goal) {
+				const State& from = m_states[u];
+				float g = from.g + arc + t.length;
+				unsigned long long k = circle == GOAL ? key(GOAL, 1, GOAL, 1) : key(from.circle, from.dir, circle, dir);
+				std::pair<std::unordered_map<unsigned long long, int>::iterator, bool> inserted
+					= m_index.insert(std::make_pair(k, static_cast<int>(m_states.size())));
+				int v = inserted.first->second;
+				if (inserted.second) {
+					State s;
+					s.circle = circle;
+					s.dir = dir;
+					s.closed = false;
+					s.g = g + 1.0f; // replaced below
+					m_states.push_back(s);
+				}
+				State& s = m_states[v];
+				if (s.closed || g >= s.g)
+					return;
+				s.g = g;
+				s.parent = u;
+				s.angle = t.to_angle;
+				s.point = t.to;
+				s.depart_angle = t.from_angle;
+				s.depart = t.from;
+				m_open.push(std::make_pair(g + (goal - t.to).length(), v));
+			}
+
+			void expand(WorldModel& world, int u, const Vector2& goal) {
+				State from = m_states[u];
+				bool at_start = from.circle == START;
+
+				// Straight to the goal.
+				if (at_start) {
+					Tangent t;
+					t.from = from.point;
+					t.to = goal;
+					t.from_angle = t.to_angle = 0.0f;
+					t.length = (goal - from.point).length();
+					if (!world.segmentIntersects(from.point, goal, m_inflation, m_start_inside))
+						relax(u, GOAL, 1, t, turnArc(t), goal);
+				} else {
+					const Edge& e = edge(world, from.circle, from.dir, GOAL, 1, goal);
+					if (e.valid) {
+						float sweep = arcAngle(from.angle, e.tangent.from_angle, from.dir);
+						float arc = sweep * grown(world, from.circle);
+						if (from.g + arc < relaxedCost(GOAL) && !arcBlocked(world, from.circle, from.angle, sweep, from.dir))
+							relax(u, GOAL, 1, e.tangent, arc, goal);
+					}
+				}
+
+				// Around the nearby obstacles, both ways.
+				world.queryRadius(from.point, m_neighborhood, m_candidates);
+				for (std::size_t n = 0; n < m_candidates.size(); ++n) {
+					int j = m_candidates[n];
+					if (j == from.circle || j == m_start_inside)
+						continue;
+					for (int dj = -1; dj <= 1; dj += 2) {
+						if (at_start) {
+							Tangent t;
+							if (!tangent(from.point, 0.0f, 1, center(world, j), grown(world, j), dj, t))
+								continue;
+							if (world.segmentIntersects(t.from, t.to, m_inflation, j, m_start_inside))
+								continue;
+							relax(u, j, dj, t, turnArc(t), goal);
+						} else {
+							const Edge& e = edge(world, from.circle, from.dir, j, dj, goal);
+							if (!e.valid)
+								continue;
+							float sweep = arcAngle(from.angle, e.tangent.from_angle, from.dir);
+							float arc = sweep * grown(world, from.circle);
+							if (from.g + arc + e.tangent.length >= relaxedCost(key(from.circle, from.dir, j, dj)))
+								continue;
+							if (arcBlocked(world, from.circle, from.angle, sweep, from.dir))
+								continue;
+							relax(u, j, dj, e.tangent, arc, goal);
+						}
+					}
+				}
+			}
+
+			// Arc the vehicle turns along before heading down a segment leaving the start.
+			float turnArc(const Tangent& t) const {
+				if (t.length == 0.0f)
+					return 0.0f;
+				Vector2 d = (t.to - t.from) / t.length;
+				return m_turn_radius * std::fabs(std::atan2(m_heading.cross(d), m_heading.dot(d)));
+			}
+
+			// Best cost found so far for the state reached through edge `k`.
+			float relaxedCost(unsigned long long k) const {
+				std::unordered_map<unsigned long long, int>::const_iterator it = m_index.find(k);
+				return it == m_index.end() ? std::numeric_limits<float>::max() : m_states[it->second].g;
+			}
+			float relaxedCost(int goal_circle) const {
+				return relaxedCost(key(goal_circle, 1, goal_circle, 1));
+			}
+
+			void buildPath(WorldModel& world, int last) {
+				m_chain.clear();
+				for (int v = last; v != -1; v = m_states[v].parent)
+					m_chain.push_back(v);
+				m_path.push_back(m_states[m_chain.back()].point);
+				for (int c = static_cast<int>(m_chain.size()) - 2; c >= 0; --c) {
+					const State& s = m_states[m_chain[c]];
+					const State& parent = m_states[m_chain[c + 1]];
+					if (parent.circle >= 0) {
+						// Walk the arc on the parent circle in a few steps, along a
+						// polygon around it: its sides are tangent to the circle, so
+						// none cuts into the obstacle and the first one leaves the
+						// arrival point straight along the circle.
+						float sweep = arcAngle(parent.angle, s.depart_angle, parent.dir);
+						float r = grown(world, parent.circle);
+						int steps = static_cast<int>(std::ceil(sweep / ARC_WAYPOINT_ANGLE));
+						Vector2 pc = center(world, parent.circle);
+						if (steps > 0) {
+							float half = 0.5f * sweep / steps;
+							float corner = r / std::cos(half);
+							for (int i = 0; i < steps; ++i) {
+								float a = parent.angle + parent.dir * (half + sweep * i / steps);
+								m_path.push_back(pc + Vector2(std::cos(a), std::sin(a)) * corner);
+							}
+						}
+						m_path.push_back(s.depart);
+					}
+					m_path.push_back(s.point);
+				}
+			}
+
+			//
+			// Makes a start inside an obstacle head a little outwards first: a
+			// vehicle pressed against it is stopped by any move the slightest
+			// bit inwards, such as one along the circle.
+			//
+			void leaveStart(const WorldModel& world, int dir) {
+				Vector2 radial = m_path[0] - center(world, m_start_inside);
+				float angle = std::atan2(radial.y, radial.x) + dir * (0.5f * static_cast<float>(M_PI) - START_ESCAPE_ANGLE);
+				Vector2 escape = m_path[0] + Vector2(std::cos(angle), std::sin(angle)) * START_ESCAPE_LEG;
+				m_path.insert(m_path.begin() + 1, escape);
+			}
+
+			long m_budget_usec;
+			float m_neighborhood;
+			float m_inflation;
+			Vector2 m_goal; // tangents towards the goal are cached too
+			std::size_t m_world_size;
+			Vector2 m_heading; // unit, or zero
+			float m_turn_radius; // vehicle's at its current speed
+			int m_start_inside; // grown obstacle the start lies in, -1 if none
+			float m_start_radius; // ... shrunk to the start
+			Edge m_shrunk_edge; // last tangent of the shrunk obstacle
+			std::vector<int> m_start_obstacles; // grown ones the start lies in
+			float m_start_clearance; // ... kept from them by the first leg
+			int m_expanded;
+			std::unordered_map<unsigned long long, Edge> m_edges;
+			std::unordered_map<unsigned long long, int> m_index;
+			std::vector<State> m_states;
+			OpenList m_open;
+			std::vector<int> m_nearby;
+			std::vector<int> m_candidates;
+			std::vector<int> m_chain;
+			std::vector<Vector2> m_path;
+	};
+
+}
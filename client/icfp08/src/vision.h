@@ -9,21 +9,11 @@ namespace Movement {
 
 	class Vision {
 		public:
-			bool homeIsVisible(Protocol::MessageTelemetryStream& telemetry, Protocol::Object *home) {
-				typedef Protocol::MessageTelemetryStream::ObjectList::const_iterator const_iterator;
-				Protocol::Object *object;
-				for (
-					const_iterator iter = telemetry.objects->begin();
-					iter != telemetry.objects->end();
-					++iter)
-				{
-					object = *iter;
-					if (object->tag == Protocol::TAG_HOME) {
-						home = object;
-						return true;
-					}
-				}
-				return false;
+			bool homeIsVisible(const Protocol::MessageTelemetryStream& telemetry, Protocol::ObjectCommon& home) {
+				if (telemetry.objects == NULL || telemetry.objects->homes.empty())
+					return false;
+				home = telemetry.objects->homes.at(0);
+				return true;
 			}
 	};
 
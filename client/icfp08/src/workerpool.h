@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include "lock.h"
+
+//
+// Fixed set of threads that split a range of indices among themselves.
+//
+// run() hands [0, count) out in chunks claimed with an atomic counter, works
+// on them from the calling thread too, and returns once every chunk is done.
+// With no threads the task simply runs inline.
+//
+class WorkerPool {
+	public:
+		typedef void (*Task)(void *context, int begin, int end);
+
+		WorkerPool(int threads) : m_task(NULL), m_context(NULL), m_count(0), m_chunk(1), m_next(0), m_busy(0), m_generation(0), m_stop(false) {
+			for (int i = 0; i < threads; ++i) {
+				pthread_t thread;
+				if (pthread_create(&thread, NULL, threadFunc, this) == 0)
+					m_threads.push_back(thread);
+			}
+		}
+		~WorkerPool() {
+			{
+				ScopeLock lock(&m_lock);
+				m_stop = true;
+				m_wake.broadcast();
+			}
+			for (std::size_t i = 0; i < m_threads.size(); ++i)
+				pthread_join(m_threads[i], NULL);
+		}
+
+		// Threads working besides the caller.
+		int threads() const {
+			return static_cast<int>(m_threads.size());
+		}
+
+		void run(Task task, void *context, int count, int chunk) {
+			if (m_threads.empty()) {
+				task(context, 0, count);
+				return;
+			}
+			{
+				ScopeLock lock(&m_lock);
+				m_task = task;
+				m_context = context;
+				m_count = count;
+				m_chunk = std::max(1, chunk);
+				m_next = 0;
+				m_busy = static_cast<int>(m_threads.size());
+				++m_generation;
+				m_wake.broadcast();
+			}
+			work();
+			ScopeLock lock(&m_lock);
+			while (m_busy > 0)
+				m_done.wait(&m_lock);
+		}
+
+	private:
+		void work() {
+			int begin;
+			while ((begin = __sync_fetch_and_add(&m_next, m_chunk)) < m_count)
+				m_task(m_context, begin, std::min(begin + m_chunk, m_count));
+		}
+
+		void loop() {
+			unsigned seen = 0;
+			while (true) {
+				{
+					ScopeLock lock(&m_lock);
+					while (m_generation == seen && !m_stop)
+						m_wake.wait(&m_lock);
+					if (m_stop)
+						return;
+					seen = m_generation;
+				}
+				work();
+				ScopeLock lock(&m_lock);
+				if (--m_busy == 0)
+					m_done.signal();
+			}
+		}
+
+		static void *threadFunc(void *arg) {
+			static_cast<WorkerPool *>(arg)->loop();
+			return NULL;
+		}
+
+		std::vector<pthread_t> m_threads;
+		Lock m_lock;
+		Condition m_wake;
+		Condition m_done;
+		Task m_task;
+		void *m_context;
+		int m_count;
+		int m_chunk;
+		volatile int m_next;
+		int m_busy;
+		unsigned m_generation;
+		bool m_stop;
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include "framer.h"
+#include "scanner.h"
+#include "dynamics.h"
+
+namespace Simulation {
+
+	using Communication::Slice;
+	using Communication::Scanner;
+	using Movement::VehicleParams;
+
+	//
+	// Just enough of JSON for the map files: numbers are read as floats and
+	// strings are taken verbatim, escapes included.
+	//
+	struct JsonValue {
+		enum Type {
+			NUL,
+			BOOLEAN,
+			NUMBER,
+			STRING,
+			ARRAY,
+			OBJECT
+		};
+		Type type;
+		float number; // NUMBER, and 1 or 0 for BOOLEAN
+		std::string text; // STRING
+		std::vector<JsonValue> items; // ARRAY and OBJECT
+		std::vector<std::string> keys; // OBJECT, one per item
+
+		JsonValue() : type(NUL), number(0.0f) {
+			// nop
+		}
+
+		std::size_t size() const {
+			return items.size();
+		}
+		const JsonValue& operator[](std::size_t i) const {
+			return items[i];
+		}
+		// Member named `key`, or NULL.
+		const JsonValue *find(const char *key) const {
+			for (std::size_t i = 0; i < keys.size(); ++i)
+				if (keys[i] == key)
+					return &items[i];
+			return NULL;
+		}
+		float get(const char *key, float fallback) const {
+			const JsonValue *value = find(key);
+			return value != NULL && value->type == NUMBER ? value->number : fallback;
+		}
+
+		static bool parse(const Slice& input, JsonValue& out) {
+			Scanner scan(input);
+			return parseValue(scan, out) && scan.atEnd();
+		}
+
+		private:
+			static bool parseValue(Scanner& scan, JsonValue& out) {
+				char c = scan.peek();
+				if (c == '{')
+					return parseObject(scan, out);
+				if (c == '[')
+					return parseArray(scan, out);
+				if (c == '"') {
+					out.type = STRING;
+					return parseString(scan, out.text);
+				}
+				if (c == 't' || c == 'f' || c == 'n')
+					return parseLiteral(scan, out);
+				out.type = NUMBER;
+				return scan.readFloat(out.number);
+			}
+			static bool parseObject(Scanner& scan, JsonValue& out) {
+				char c;
+				scan.readChar(c);
+				out.type = OBJECT;
+				if (scan.peek() == '}')
+					return scan.readChar(c);
+				do {
+					out.keys.push_back(std::string());
+					out.items.push_back(JsonValue());
+					if (!parseString(scan, out.keys.back()) || !scan.readChar(c) || c != ':')
+						return false;
+					if (!parseValue(scan, out.items.back()) || !scan.readChar(c))
+						return false;
+				} while (c == ',');
+				return c == '}';
+			}
+			static bool parseArray(Scanner& scan, JsonValue& out) {
+				char c;
+				scan.readChar(c);
+				out.type = ARRAY;
+				if (scan.peek() == ']')
+					return scan.readChar(c);
+				do {
+					out.items.push_back(JsonValue());
+					if (!parseValue(scan, out.items.back()) || !scan.readChar(c))
+						return false;
+				} while (c == ',');
+				return c == ']';
+			}
+			static bool parseString(Scanner& scan, std::string& out) {
+				char c;
+				if (!scan.readChar(c) || c != '"')
+					return false;
+				while (scan.readRawChar(c)) {
+					if (c == '"')
+						return true;
+					out += c;
+					if (c == '\\' && scan.readRawChar(c))
+						out += c;
+				}
+				return false;
+			}
+			static bool parseLiteral(Scanner& scan, JsonValue& out) {
+				std::string word;
+				char c;
+				if (!scan.readChar(c))
+					return false;
+				word += c;
+				while (scan.peek() >= 'a' && scan.peek() <= 'z' && scan.readRawChar(c))
+					word += c;
+				if (word == "null") {
+					out.type = NUL;
+					return true;
+				}
+				out.type = BOOLEAN;
+				out.number = word == "true" ? 1.0f : 0.0f;
+				return word == "true" || word == "false";
+			}
+	};
+
+	struct Circle {
+		float x; // meters
+		float y; // meters
+		float r; // meters
+	};
+
+	struct EnemyStart {
+		float x; // meters
+		float y; // meters
+		float dir; // counterclockwise angle from the x-axis in degrees
+		float speed; // fraction of the top speed it roams at
+		float view; // meters it spots the rover from
+	};
+
+	struct RunStart {
+		float x; // meters
+		float y; // meters
+		float dir; // degrees
+		std::vector<EnemyStart> enemies;
+	};
+
+	//
+	// A region of Mars as described by the contest's .wrld files: its size and
+	// time limit, the rover's and Martians' parameters, the obstacles and the
+	// starting positions of every run.
+	//
+	struct WorldMap {
+		float size; // meters, the map spans [-size/2, size/2] on both axes
+		int time_limit; // milliseconds per run
+		VehicleParams vehicle;
+		VehicleParams martian;
+		float front_view; // meters
+		float rear_view; // meters
+		std::vector<Circle> boulders;
+		std::vector<Circle> craters;
+		std::vector<RunStart> runs;
+
+		WorldMap() : size(0.0f), time_limit(0), front_view(0.0f), rear_view(0.0f) {
+			// nop
+		}
+
+		// Reads a .wrld file; on failure `error` tells why.
+		bool load(const std::string& path, std::string& error) {
+			std::ifstream file(path.c_str());
+			if (!file) {
+				error = "cannot open " + path;
+				return false;
+			}
+			std::stringstream contents;
+			contents << file.rdbuf();
+			std::string text = contents.str();
+			JsonValue root;
+			if (!JsonValue::parse(Slice(text.data(), text.size()), root) || root.type != JsonValue::OBJECT) {
+				error = path + " is not valid JSON";
+				return false;
+			}
+			size = root.get("size", 0.0f);
+			time_limit = static_cast<int>(root.get("timeLimit", 0.0f));
+			const JsonValue *params = root.find("vehicleParams");
+			if (size <= 0.0f || time_limit <= 0 || params == NULL) {
+				error = path + " lacks the size, time limit or vehicle parameters";
+				return false;
+			}
+			readParams(*params, vehicle);
+			front_view = params->get("frontView", 60.0f);
+			rear_view = params->get("rearView", 30.0f);
+			martian = vehicle;
+			if ((params = root.find("martianParams")) != NULL)
+				readParams(*params, martian);
+			readCircles(root.find("boulders"), boulders);
+			readCircles(root.find("craters"), craters);
+
+			runs.clear();
+			const JsonValue *list = root.find("runs");
+			for (std::size_t i = 0; list != NULL && i < list->size(); ++i) {
+				const JsonValue *start = (*list)[i].find("vehicle");
+				if (start == NULL)
+					continue;
+				RunStart run;
+				run.x = start->get("x", 0.0f);
+				run.y = start->get("y", 0.0f);
+				run.dir = start->get("dir", 0.0f);
+				const JsonValue *enemies = (*list)[i].find("enemies");
+				for (std::size_t j = 0; enemies != NULL && j < enemies->size(); ++j) {
+					const JsonValue& enemy = (*enemies)[j];
+					EnemyStart e = {
+						enemy.get("x", 0.0f), enemy.get("y", 0.0f), enemy.get("dir", 0.0f),
+						enemy.get("speed", 0.25f), enemy.get("view", 60.0f)
+					};
+					run.enemies.push_back(e);
+				}
+				runs.push_back(run);
+			}
+			if (runs.empty()) {
+				error = path + " has no runs";
+				return false;
+			}
+			return true;
+		}
+
+		private:
+			static void readParams(const JsonValue& params, VehicleParams& out) {
+				out.max_speed = params.get("maxSpeed", out.max_speed);
+				out.accel = params.get("accel", out.accel);
+				out.brake = params.get("brake", out.brake);
+				out.turn = params.get("turn", out.turn);
+				out.hard_turn = params.get("hardTurn", out.hard_turn);
+				out.rot_accel = params.get("rotAccel", out.rot_accel);
+			}
+			static void readCircles(const JsonValue *list, std::vector<Circle>& out) {
+				out.clear();
+				for (std::size_t i = 0; list != NULL && i < list->size(); ++i) {
+					Circle c = { (*list)[i].get("x", 0.0f), (*list)[i].get("y", 0.0f), (*list)[i].get("r", 0.0f) };
+					out.push_back(c);
+				}
+			}
+	};
+
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "protocol.h"
+#include "vector2.h"
+#include "quadtree.h"
+
+namespace Movement {
+
+	using namespace Communication;
+
+	// Sightings closer than this (position and radius) are the same obstacle (meters).
+	const float SAME_OBSTACLE_EPSILON = 0.05f;
+
+	//
+	// Static obstacles (boulders and craters) seen so far, kept across ticks
+	// and across the runs of a trial.
+	//
+	// Obstacles are stored as parallel arrays and indexed by a Quadtree over
+	// the map, so proximity and segment queries only visit the leaves around
+	// the query instead of every known obstacle, and large sparse maps cost
+	// no more than their obstacles.
+	//
+	class WorldModel {
+		public:
+			std::vector<float> x;
+			std::vector<float> y;
+			std::vector<float> radius;
+			std::vector<Protocol::ObjectTag> tag;
+
+			WorldModel() : m_map_size(Vector2::ZERO) {
+				// nop
+			}
+
+			//
+			// Sizes the index for a map of dx by dy meters centered at the origin.
+			// The obstacles are kept if the map did not change, since all runs of
+			// a trial take place on the same region.
+			//
+			void reset(float dx, float dy) {
+				if (m_index.nodes() > 0 && dx == m_map_size.x && dy == m_map_size.y)
+					return;
+				m_map_size.set(dx, dy);
+				m_index.reset(m_map_size);
+				clear();
+			}
+			void clear() {
+				x.clear();
+				y.clear();
+				radius.clear();
+				tag.clear();
+				m_index.clear();
+			}
+			std::size_t size() const {
+				return x.size();
+			}
+			// As given to the last reset().
+			const Vector2& mapSize() const {
+				return m_map_size;
+			}
+			// Square enclosing the map, the one freeCells() starts halving.
+			Quadtree::Cell bounds() const {
+				return m_index.root();
+			}
+			CircleSet circles() const {
+				return CircleSet(x, y, radius);
+			}
+
+			//
+			// Adds an obstacle unless it is already known.
+			// Returns whether it was new.
+			//
+			bool insert(Protocol::ObjectTag obj_tag, float obj_x, float obj_y, float obj_radius) {
+				if (m_index.nodes() == 0)
+					return false;
+				m_index.candidates(obj_x - SAME_OBSTACLE_EPSILON, obj_y - SAME_OBSTACLE_EPSILON,
+					obj_x + SAME_OBSTACLE_EPSILON, obj_y + SAME_OBSTACLE_EPSILON, m_found);
+				for (std::size_t n = 0; n < m_found.size(); ++n) {
+					int i = m_found[n];
+					if (std::fabs(x[i] - obj_x) < SAME_OBSTACLE_EPSILON
+						&& std::fabs(y[i] - obj_y) < SAME_OBSTACLE_EPSILON
+						&& std::fabs(radius[i] - obj_radius) < SAME_OBSTACLE_EPSILON
+						&& tag[i] == obj_tag)
+						return false;
+				}
+				int index = static_cast<int>(x.size());
+				x.push_back(obj_x);
+				y.push_back(obj_y);
+				radius.push_back(obj_radius);
+				tag.push_back(obj_tag);
+				m_index.insert(circles(), index);
+				return true;
+			}
+
+			//
+			// Adds the boulders and craters of a telemetry message.
+			// Returns how many of them were not known yet.
+			//
+			int insert(const Protocol::ObjectStore& objects) {
+				int inserted = 0;
+				for (std::size_t i = 0; i < objects.boulders.size(); ++i)
+					inserted += insert(Protocol::TAG_BOULDER, objects.boulders.x[i], objects.boulders.y[i], objects.boulders.radius[i]);
+				for (std::size_t i = 0; i < objects.craters.size(); ++i)
+					inserted += insert(Protocol::TAG_CRATER, objects.craters.x[i], objects.craters.y[i], objects.craters.radius[i]);
+				return inserted;
+			}
+
+			//
+			// Collects the obstacles whose border is within `range` of `point`.
+			//
+			void queryRadius(const Vector2& point, float range, std::vector<int>& result) {
+				m_index.queryRadius(circles(), point, range, result);
+			}
+
+			//
+			// Whether any obstacle, grown by `inflate`, contains `point`.
+			//
+			bool isBlocked(const Vector2& point, float inflate) {
+				return m_index.firstContaining(circles(), point, inflate) != -1;
+			}
+
+			//
+			// Whether the segment from `a` to `b`, grown by `inflate`, touches any obstacle
+			// other than `ignore_a` and `ignore_b` (e.g. the ones it is tangent to).
+			//
+			bool segmentIntersects(const Vector2& a, const Vector2& b, float inflate, int ignore_a = -1, int ignore_b = -1) {
+				return m_index.firstSegmentHit(circles(), a, b, inflate, ignore_a, ignore_b) != -1;
+			}
+
+			//
+			// Covers the map with the largest squares, down to `min_size` meters,
+			// clear of every obstacle grown by `inflate` (see Quadtree::freeCells()).
+			//
+			void freeCells(float inflate, float min_size, std::vector<Quadtree::Cell>& cells) {
+				m_index.freeCells(circles(), inflate, min_size, cells);
+			}
+
+			static float distanceSqToSegment(const Vector2& p, const Vector2& a, const Vector2& b) {
+				return Quadtree::distanceSqToSegment(p, a, b);
+			}
+
+		private:
+			Vector2 m_map_size;
+			Quadtree m_index;
+			std::vector<int> m_found;
+	};
+
+}
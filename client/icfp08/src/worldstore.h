@@ -0,0 +1,285 @@
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "protocol.h"
+#include "worldmodel.h"
+#include "log.h"
+
+namespace Movement {
+
+	const char WORLD_STORE_MAGIC[8] = { 'I', 'C', 'F', 'P', 'W', 'L', 'D', '1' };
+	// Obstacles first seen in a run that must all be in a snapshot for it to be the same map.
+	const std::size_t WORLD_STORE_KEY_OBSTACLES = 8;
+
+	//
+	// Obstacles of the maps played before, kept in a file across runs and
+	// across processes, so a restarted client knows the whole map from the
+	// first telemetry of a run instead of from the last one.
+	//
+	// The file is a WORLD_STORE_MAGIC followed by one snapshot per map: a
+	// StoredSnapshot with the map size and the obstacle count, and then the
+	// obstacles as StoredObstacles. It is mapped read-only and the obstacles
+	// are read in place, with no parsing. save() writes a new file next to
+	// it, through a shared mapping, and renames it over the old one.
+	//
+	// A snapshot is picked by the size of the map and by the obstacles first
+	// seen after the reset: every one of the first WORLD_STORE_KEY_OBSTACLES
+	// must be in it, wherever the vehicle started from. Nothing is loaded
+	// before that many were seen, and maps with fewer are not saved.
+	//
+	// All calls are the planner's, see ControllerState::applyWorldEvents().
+	//
+	struct StoredSnapshot {
+		float dx; // map size (meters)
+		float dy;
+		uint32_t count; // StoredObstacles following
+		uint32_t reserved;
+	};
+
+	struct StoredObstacle {
+		float x;
+		float y;
+		float radius;
+		int32_t tag; // Protocol::ObjectTag
+	};
+
+	class WorldStore {
+		public:
+			WorldStore() : m_read_only(false), m_fd(-1), m_base(NULL), m_size(0), m_matching(false), m_match(-1), m_saved(0), m_loaded(0) {
+				// nop
+			}
+			~WorldStore() {
+				unmap();
+			}
+
+			//
+			// Maps the snapshots of `path`, if it exists; save() creates it otherwise.
+			// False if it exists but cannot be read or is not a world file.
+			// A read-only store loads but never saves, e.g. to replay a session.
+			//
+			bool open(const char *path, bool read_only = false) {
+				m_path = path;
+				m_read_only = read_only;
+				return map();
+			}
+			bool isOpen() const {
+				return !m_path.empty();
+			}
+			std::size_t snapshots() const {
+				return m_snapshots.size();
+			}
+			// Obstacles taken from the file so far.
+			std::size_t loaded() const {
+				return m_loaded;
+			}
+
+			//
+			// The world was reset: if it was emptied for a new map, look for the
+			// snapshot of that map in the next frames.
+			//
+			void reset(const WorldModel& world) {
+				m_matching = world.size() == 0;
+				m_match = -1;
+				m_saved = world.size();
+			}
+
+			//
+			// A telemetry frame was applied: once the world holds a key of its
+			// own, adds the obstacles of the snapshot it matches, if any.
+			// Returns how many obstacles were added.
+			//
+			int frame(WorldModel& world) {
+				if (!m_matching || world.size() < WORLD_STORE_KEY_OBSTACLES)
+					return 0;
+				m_matching = false;
+				m_match = find(world);
+				if (m_match == -1)
+					return 0;
+				const StoredSnapshot& snapshot = snapshotAt(m_match);
+				const StoredObstacle *obstacles = obstaclesOf(m_match);
+				int inserted = 0;
+				for (uint32_t i = 0; i < snapshot.count; ++i)
+					inserted += world.insert(static_cast<Protocol::ObjectTag>(obstacles[i].tag), obstacles[i].x, obstacles[i].y, obstacles[i].radius);
+				m_loaded += inserted;
+				m_saved = world.size();
+				LOG_INFO("world store: " << inserted << " obstacles of a " << snapshot.dx << "x" << snapshot.dy << " map loaded");
+				return inserted;
+			}
+
+			//
+			// Writes the world in place of the snapshot of its map, keeping those
+			// of the other maps, unless nothing was seen since the last load or save
+			// or there are fewer obstacles than a key.
+			//
+			bool save(const WorldModel& world) {
+				if (!isOpen() || m_read_only || world.size() <= m_saved || world.size() < WORLD_STORE_KEY_OBSTACLES)
+					return true;
+				int replaced = m_match != -1 ? m_match : find(world);
+				std::size_t size = sizeof(WORLD_STORE_MAGIC) + sizeof(StoredSnapshot) + world.size() * sizeof(StoredObstacle);
+				for (std::size_t k = 0; k < m_snapshots.size(); ++k) {
+					if (static_cast<int>(k) != replaced)
+						size += snapshotBytes(k);
+				}
+				std::string temporary = m_path + ".tmp";
+				int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+				if (fd == -1) {
+					perror("open");
+					return false;
+				}
+				if (ftruncate(fd, size) == -1) {
+					perror("ftruncate");
+					::close(fd);
+					return false;
+				}
+				void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				::close(fd);
+				if (base == MAP_FAILED) {
+					perror("mmap");
+					return false;
+				}
+				char *out = static_cast<char *>(base);
+				memcpy(out, WORLD_STORE_MAGIC, sizeof(WORLD_STORE_MAGIC));
+				std::size_t offset = sizeof(WORLD_STORE_MAGIC);
+				for (std::size_t k = 0; k < m_snapshots.size(); ++k) {
+					if (static_cast<int>(k) == replaced)
+						continue;
+					memcpy(out + offset, m_base + m_snapshots[k], snapshotBytes(k));
+					offset += snapshotBytes(k);
+				}
+				StoredSnapshot snapshot = { world.mapSize().x, world.mapSize().y, static_cast<uint32_t>(world.size()), 0 };
+				memcpy(out + offset, &snapshot, sizeof(snapshot));
+				offset += sizeof(snapshot);
+				for (std::size_t i = 0; i < world.size(); ++i) {
+					StoredObstacle obstacle = { world.x[i], world.y[i], world.radius[i], static_cast<int32_t>(world.tag[i]) };
+					memcpy(out + offset, &obstacle, sizeof(obstacle));
+					offset += sizeof(obstacle);
+				}
+				munmap(base, size);
+				if (rename(temporary.c_str(), m_path.c_str()) == -1) {
+					perror("rename");
+					return false;
+				}
+				if (!map())
+					return false;
+				// Ours is the last one now.
+				m_match = static_cast<int>(m_snapshots.size()) - 1;
+				m_saved = world.size();
+				LOG_INFO("world store: " << world.size() << " obstacles saved, " << m_snapshots.size() << " maps");
+				return true;
+			}
+
+		private:
+			// (Re)maps the file and finds where its snapshots start.
+			bool map() {
+				unmap();
+				m_fd = ::open(m_path.c_str(), O_RDONLY);
+				if (m_fd == -1)
+					return errno == ENOENT;
+				struct stat info;
+				if (fstat(m_fd, &info) == -1 || info.st_size < static_cast<off_t>(sizeof(WORLD_STORE_MAGIC))) {
+					fprintf(stderr, "%s: not a world file\n", m_path.c_str());
+					return false;
+				}
+				void *base = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+				if (base == MAP_FAILED) {
+					perror("mmap");
+					return false;
+				}
+				m_base = static_cast<const char *>(base);
+				m_size = info.st_size;
+				if (memcmp(m_base, WORLD_STORE_MAGIC, sizeof(WORLD_STORE_MAGIC)) != 0) {
+					fprintf(stderr, "%s: not a world file\n", m_path.c_str());
+					return false;
+				}
+				std::size_t offset = sizeof(WORLD_STORE_MAGIC);
+				while (offset + sizeof(StoredSnapshot) <= m_size) {
+					StoredSnapshot snapshot;
+					memcpy(&snapshot, m_base + offset, sizeof(snapshot));
+					std::size_t bytes = sizeof(snapshot) + snapshot.count * sizeof(StoredObstacle);
+					if (offset + bytes > m_size)
+						break; // truncated, keep what came before
+					m_snapshots.push_back(offset);
+					offset += bytes;
+				}
+				return true;
+			}
+			void unmap() {
+				if (m_base != NULL) {
+					munmap(const_cast<char *>(m_base), m_size);
+					m_base = NULL;
+					m_size = 0;
+				}
+				if (m_fd != -1) {
+					::close(m_fd);
+					m_fd = -1;
+				}
+				m_snapshots.clear();
+			}
+
+			const StoredSnapshot& snapshotAt(int k) const {
+				return *reinterpret_cast<const StoredSnapshot *>(m_base + m_snapshots[k]);
+			}
+			const StoredObstacle *obstaclesOf(int k) const {
+				return reinterpret_cast<const StoredObstacle *>(m_base + m_snapshots[k] + sizeof(StoredSnapshot));
+			}
+			std::size_t snapshotBytes(int k) const {
+				return sizeof(StoredSnapshot) + snapshotAt(k).count * sizeof(StoredObstacle);
+			}
+
+			//
+			// The snapshot of a map of the same size holding the first
+			// WORLD_STORE_KEY_OBSTACLES obstacles of the world, the last one saved
+			// if several do; -1 for none, or if the world has fewer.
+			//
+			int find(const WorldModel& world) const {
+				if (world.size() < WORLD_STORE_KEY_OBSTACLES)
+					return -1;
+				for (int k = static_cast<int>(m_snapshots.size()) - 1; k >= 0; --k) {
+					const StoredSnapshot& snapshot = snapshotAt(k);
+					if (snapshot.dx != world.mapSize().x || snapshot.dy != world.mapSize().y)
+						continue;
+					std::size_t i = 0;
+					while (i < WORLD_STORE_KEY_OBSTACLES && contains(k, world, i))
+						++i;
+					if (i == WORLD_STORE_KEY_OBSTACLES)
+						return k;
+				}
+				return -1;
+			}
+			// Whether the `k`-th snapshot holds the `i`-th obstacle of the world.
+			bool contains(int k, const WorldModel& world, std::size_t i) const {
+				const StoredSnapshot& snapshot = snapshotAt(k);
+				const StoredObstacle *obstacles = obstaclesOf(k);
+				for (uint32_t n = 0; n < snapshot.count; ++n) {
+					if (std::fabs(obstacles[n].x - world.x[i]) < SAME_OBSTACLE_EPSILON
+						&& std::fabs(obstacles[n].y - world.y[i]) < SAME_OBSTACLE_EPSILON
+						&& std::fabs(obstacles[n].radius - world.radius[i]) < SAME_OBSTACLE_EPSILON
+						&& obstacles[n].tag == static_cast<int32_t>(world.tag[i]))
+						return true;
+				}
+				return false;
+			}
+
+			std::string m_path;
+			bool m_read_only;
+			int m_fd;
+			const char *m_base; // NULL until the file exists
+			std::size_t m_size;
+			std::vector<std::size_t> m_snapshots; // offsets in the file
+			bool m_matching; // looking for the snapshot of the current map
+			int m_match; // snapshot of the current map, -1 if none
+			std::size_t m_saved; // obstacles of the world already in the file
+			std::size_t m_loaded;
+	};
+
+}